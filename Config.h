@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#define CONFIG_PATH "$[HOME]/.config/elgatoControl"
+#define SOCKET_FILE "$[HOME]/.local/elgatoDaemon.sock"
+#define CMAKE_INSTALL_PREFIX "/root/.local"
+#define DEBUG_BUILD 0
+
+// Metadata key a client sends its ObserveChanges clientId in, its own changes are then not echoed back to it
+#define CLIENT_ID_METADATA "elgato-client-id"
+// Metadata key for the traffic class of a control request: "interactive", "automation" or "poll"
+#define TRAFFIC_CLASS_METADATA "elgato-traffic-class"
+// Trailing metadata key of a RESOURCE_EXHAUSTED reply, milliseconds until the request may be sent again
+#define RETRY_AFTER_METADATA "elgato-retry-after-ms"
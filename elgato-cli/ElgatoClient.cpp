@@ -27,6 +27,11 @@
 
 #include <grpcpp/create_channel.h>
 #include <fmt/core.h>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+
+#include "../Config.h"
 
 using ::grpc::ClientContext;
 using ::grpc::CreateChannel;
@@ -56,6 +61,11 @@ std::string ElgatoClient::expand_with_environment(const std::string &s) {
     return expand_with_environment(pre + value + post);
 }
 
+// Quotas are per client id, one for everything started from the same shell or script
+void ElgatoClient::identify(ClientContext& context) {
+    context.AddMetadata(CLIENT_ID_METADATA, fmt::format("elgato-cli-{}", getppid()));
+}
+
 void ElgatoClient::listFixtures() {
     Empty empty;
     FixtureList fixtureList;
@@ -64,7 +74,7 @@ void ElgatoClient::listFixtures() {
     _stub->ListFixtures(&context, empty, &fixtureList);
 
     for(auto& fixture : fixtureList.fixtures()) {
-        fmt::print("  {} ({}) is {} with s/n {} (Power {} @ {}%, {}K)\n", fixture.name(), fixture.displayname(), fixture.productname(), fixture.serialnumber(), fixture.powerstate() ? "on" : "off", fixture.brightness(), fixture.temperature());
+        fmt::print("  [{}] {} ({}) is {} with s/n {} (Power {} @ {}%, {}K)\n", fixture.handle(), fixture.name(), fixture.displayname(), fixture.productname(), fixture.serialnumber(), fixture.powerstate() ? "on" : "off", fixture.brightness(), fixture.temperature());
     }
 }
 
@@ -72,6 +82,7 @@ void ElgatoClient::refreshBrowser() {
     ClientContext context;
     Empty empty;
     SimpleCliResponse response;
+    identify(context);
 
     fmt::print("Refreshing fixture list...");
 
@@ -83,10 +94,62 @@ void ElgatoClient::refreshBrowser() {
         fmt::print(" Error!\n");
 }
 
+void ElgatoClient::printStats() {
+    ClientContext context;
+    Empty empty;
+    DaemonStats stats;
+
+    auto status = _stub->GetStats(&context, empty, &stats);
+
+    if (!status.ok()) {
+        fmt::print("Error: {}\n", status.error_message());
+        return;
+    }
+
+    fmt::print("Discovery:\n");
+    fmt::print("  {} known light(s), {} currently lost\n", stats.discovery().knownlights(), stats.discovery().lostlights());
+    fmt::print("  {} flap(s) absorbed, {} light(s) expired\n", stats.discovery().flapsabsorbed(), stats.discovery().lightsexpired());
+    fmt::print("  {} duplicate resolve(s) skipped\n", stats.discovery().duplicatesskipped());
+
+    fmt::print("Admission:\n");
+    fmt::print("  {} operation(s) in flight, {} over quota, {} refused as overloaded\n", stats.admission().inflight(),
+               stats.admission().overquota(), stats.admission().overloaded());
+
+    fmt::print("Traffic:\n");
+    for(auto& traffic : stats.traffic()) {
+        fmt::print("  {}: {} request(s), queued", TrafficClass_Name(traffic.trafficclass()), traffic.requests());
+        uint64_t lowerBound = 0;
+        for(auto& bucket : traffic.queuelatency()) {
+            if (bucket.count() > 0 && bucket.upperboundus() == 0)
+                fmt::print(" >{}us: {}", lowerBound, bucket.count());
+            else if (bucket.count() > 0)
+                fmt::print(" <={}us: {}", bucket.upperboundus(), bucket.count());
+
+            lowerBound = bucket.upperboundus();
+        }
+        fmt::print("\n");
+    }
+
+    fmt::print("Lights:\n");
+    for(auto& light : stats.lights()) {
+        fmt::print("  [{}] {}: srtt {}us, rttvar {}us, timeout {}ms (connect {}ms)\n", light.handle(), light.name(), light.srttus(),
+                   light.rttvarus(), light.requesttimeoutms(), light.connecttimeoutms());
+        fmt::print("      {} write(s) elided, {} hedge(s) issued, {} won\n", light.writeselided(), light.hedgesissued(), light.hedgeswon());
+    }
+
+    fmt::print("Subscribers:\n");
+    for(auto& subscriber : stats.subscribers()) {
+        fmt::print("  {} ({}, capacity {}): {} queued, {} dropped, {} echo(es) suppressed\n", subscriber.clientid(),
+                   BackpressurePolicy_Name(subscriber.policy()), subscriber.capacity(), subscriber.depth(), subscriber.dropped(),
+                   subscriber.echoessuppressed());
+    }
+}
+
 void ElgatoClient::powerOn(const std::string& fixtureFilter) {
     ClientContext context;
     SimpleCliRequest request;
     SimpleCliResponse response;
+    identify(context);
 
     request.set_fixturefilter(fixtureFilter);
 
@@ -104,6 +167,7 @@ void ElgatoClient::powerOff(const std::string& fixtureFilter) {
     ClientContext context;
     SimpleCliRequest request;
     SimpleCliResponse response;
+    identify(context);
 
     request.set_fixturefilter(fixtureFilter);
 
@@ -121,6 +185,7 @@ void ElgatoClient::setBrightness(const std::string& fixtureFilter, long newValue
     ClientContext context;
     Int32CliRequest request;
     SimpleCliResponse response;
+    identify(context);
 
     request.set_fixturefilter(fixtureFilter);
     request.set_newvalue(newValue);
@@ -139,6 +204,7 @@ void ElgatoClient::setTemperature(const std::string& fixtureFilter, long newValu
     ClientContext context;
     Int32CliRequest request;
     SimpleCliResponse response;
+    identify(context);
 
     request.set_fixturefilter(fixtureFilter);
     request.set_newvalue(newValue);
@@ -153,16 +219,99 @@ void ElgatoClient::setTemperature(const std::string& fixtureFilter, long newValu
         fmt::print(" Error!\n");
 }
 
-void ElgatoClient::listenForChanges() {
-    _listenerThread = new std::thread([this] {
+// One command per line: <filter> on|off|brightness <value>|temperature <value>
+bool ElgatoClient::applyBatch(std::istream& input) {
+    ClientContext context;
+    BatchRequest request;
+    BatchResponse response;
+    identify(context);
+
+    std::string line;
+    while(std::getline(input, line)) {
+        std::istringstream fields(line);
+        std::string filter, operation;
+        uint32_t value = 0;
+
+        if (!(fields >> filter >> operation)) continue;
+        fields >> value;
+
+        auto command = request.add_commands();
+        command->set_fixturefilter(filter);
+        command->set_value(value);
+
+        if (operation == "on") command->set_operation(POWER_ON);
+        else if (operation == "off") command->set_operation(POWER_OFF);
+        else if (operation == "brightness") command->set_operation(SET_BRIGHTNESS);
+        else if (operation == "temperature") command->set_operation(SET_TEMPERATURE);
+        else {
+            fmt::print("Unknown operation '{}' in: {}\n", operation, line);
+            return false;
+        }
+    }
+
+    auto status = _stub->ApplyBatch(&context, request, &response);
+
+    if (!status.ok()) {
+        fmt::print("Error: {}\n", status.error_message());
+        return false;
+    }
+
+    for(auto& result : response.results()) {
+        fmt::print("#{} {}: {} ({}us)\n", result.command(), result.fixturename().empty() ? "-" : result.fixturename(),
+                   result.successful() ? "OK" : result.error(), result.latencyus());
+    }
+
+    return response.successful();
+}
+
+void ElgatoClient::listenForChanges(const std::string& fixtureFilter) {
+    _listenerThread = new std::thread([this, fixtureFilter] {
         ClientContext context;
-        Empty request;
+        ObserveRequest request;
         FixtureUpdate update;
+        // Changes only carry the handle, the names come from the snapshot and the fixture events
+        std::map<uint32_t, std::string> names;
+
+        request.set_fixturefilter(fixtureFilter);
+        request.set_snapshot(true);
+        request.set_handlesonly(true);
 
         auto reader = _stub->ObserveChanges(&context, request);
 
         while(reader->Read(&update)) {
-            std::cout << "Update from Server for: " << update.fixturename() << ": " << update.propertyname() << " changed to " << update.newvalue() << "(clid: " << update.clientid() << ")" << std::endl;
+            if (update.has_snapshot()) {
+                std::cout << "Fixtures at sequence " << update.sequence() << ":" << std::endl;
+                for(auto& fixture : update.snapshot().fixtures()) {
+                    names[fixture.handle()] = fixture.name();
+                    fmt::print("  [{}] {} (Power {} @ {}%, {}K)\n", fixture.handle(), fixture.name(), fixture.powerstate() ? "on" : "off", fixture.brightness(), fixture.temperature());
+                }
+            }
+
+            if (update.resyncrequired()) {
+                std::cout << "Fell too far behind, the daemon closed the stream" << std::endl;
+                break;
+            }
+
+            switch(update.eventtype()) {
+                case FIXTURE_ADDED:
+                    names[update.handle()] = update.fixturename();
+                    std::cout << "Fixture added: " << update.fixturename() << " (" << update.fixture().displayname() << ")" << std::endl;
+                    break;
+                case FIXTURE_REMOVED:
+                    names.erase(update.handle());
+                    std::cout << "Fixture removed: " << update.fixturename() << std::endl;
+                    break;
+                case FIXTURE_CHANGED:
+                    names[update.handle()] = update.fixturename();
+                    std::cout << "Fixture changed: " << update.fixturename() << (update.fixture().isready() ? "" : " (not ready)") << std::endl;
+                    break;
+                default:
+                    for(auto& change : update.changes()) {
+                        auto name = names.find(change.handle());
+                        std::cout << "Update from Server for: " << (name != names.end() ? name->second : "#" + std::to_string(change.handle())) << ": " << FixtureProperty_Name(change.property()) << " changed to " << change.newvalue() << "(clid: " << update.clientid() << ")" << std::endl;
+                    }
+                    break;
+            }
         }
     });
 
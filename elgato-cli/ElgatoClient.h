@@ -26,6 +26,7 @@
 
 #pragma once
 
+#include <istream>
 #include <memory>
 #include <grpc/grpc.h>
 #include <grpcpp/channel.h>
@@ -43,16 +44,19 @@ public:
 
     void listFixtures();
     void refreshBrowser();
+    void printStats();
 
     void powerOn(const std::string&);
     void powerOff(const std::string&);
     void setBrightness(const std::string&, long);
     void setTemperature(const std::string&, long);
+    bool applyBatch(std::istream&);
 
-    void listenForChanges();
+    void listenForChanges(const std::string& fixtureFilter);
 
 private:
     static std::string expand_with_environment( const std::string &s );
+    static void identify(grpc::ClientContext&);
 
     std::unique_ptr<Elgato::Stub> _stub;
     std::thread* _listenerThread;
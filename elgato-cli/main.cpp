@@ -41,6 +41,8 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[]) {
             { "temperature",optional_argument,nullptr,'t' },
             { "help",       optional_argument,nullptr,'h' },
             {"listen",      optional_argument,nullptr,'L' },
+            { "stats",      optional_argument,nullptr,'s' },
+            { "batch",      optional_argument,nullptr,'B' },
     };
 
     bool listMode = false;
@@ -55,10 +57,12 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[]) {
     bool showLongHelp = false;
     bool showShortHelp = false;
     bool listen = false;
+    bool stats = false;
+    bool batch = false;
 
     while(1) {
         int index = -1;
-        auto result = getopt_long(argc, argv, "LlnoOh", long_options, &index);
+        auto result = getopt_long(argc, argv, "LlnoOhsB", long_options, &index);
         if (result == -1) break;
 
         switch(result) {
@@ -68,6 +72,12 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[]) {
             case 'l':
                 listMode = true;
                 break;
+            case 's':
+                stats = true;
+                break;
+            case 'B':
+                batch = true;
+                break;
             case 'r':
                 refresh = true;
                 break;
@@ -109,10 +119,10 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[]) {
         }
     }
 
-    if (!listMode && !refresh && !powerOn && !powerOff && !showLongHelp && !setBrightness && !setTemperature && !listen)
+    if (!listMode && !refresh && !powerOn && !powerOff && !showLongHelp && !setBrightness && !setTemperature && !listen && !stats && !batch)
         showShortHelp = true;
 
-    if (!listMode && !refresh && !listen && !showShortHelp && !showLongHelp && nameOfLight.empty())
+    if (!listMode && !refresh && !listen && !stats && !batch && !showShortHelp && !showLongHelp && nameOfLight.empty())
         showShortHelp = true;
 
     if (!nameOfLight.empty() && !powerOn && !powerOff && !showLongHelp && !setBrightness && !setTemperature)
@@ -133,6 +143,8 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[]) {
         fmt::print("Generic functions:\n");
         fmt::print(" -l, --list\t\tLists all discoverd lights with some basic informations\n");
         fmt::print(" -r, --refresh\t\tAsks the daemon to refresh the list of lights discoverd\n");
+        fmt::print(" -s, --stats\t\tPrints the daemon's statistics\n");
+        fmt::print(" -B, --batch\t\tReads commands from stdin and sends them at once, one per line:\n\t\t\t<name> on|off|brightness VALUE|temperature VALUE\n");
         fmt::print(" -h, --help\t\tPrints out this help\n\n");
 
         fmt::print("Fixture functions: (These all need a specified fixture using --name)\n");
@@ -150,7 +162,7 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[]) {
     ElgatoClient client(channel);
 
     if (listen) {
-        client.listenForChanges();
+        client.listenForChanges(nameOfLight);
 
         std::string line;
         std::cout << "Console interface:\n  q -> quit" << std::endl;
@@ -175,6 +187,15 @@ int main([[maybe_unused]] int argc, [[maybe_unused]] char* argv[]) {
         return 0;
     }
 
+    if (stats) {
+        client.printStats();
+        return 0;
+    }
+
+    if (batch) {
+        return client.applyBatch(std::cin) ? 0 : 1;
+    }
+
     if (powerOn) {
         client.powerOn(nameOfLight);
     }
@@ -25,6 +25,7 @@
  */
 
 #include "ElgatoClient.h"
+#include "../Config.h"
 
 #include <grpcpp/create_channel.h>
 
@@ -65,15 +66,30 @@ std::vector<std::shared_ptr<RemoteFixture>> ElgatoClient::listFixtures() {
     _stub->ListFixtures(&context, empty, &fixtureList);
 
     for(auto& fixture : fixtureList.fixtures()) {
-        auto sharedFix = std::make_shared<RemoteFixture>(
-                fixture.name(), fixture.isready(), fixture.displayname(), fixture.productname(), fixture.serialnumber(),
-                fixture.powerstate(), fixture.brightness(), fixture.temperature());
-        fixtures.push_back(sharedFix);
+        fixtures.push_back(fromFixture(fixture));
     }
 
     return fixtures;
 }
 
+std::shared_ptr<RemoteFixture> ElgatoClient::fromFixture(const Fixture& fixture) {
+    auto remote = std::make_shared<RemoteFixture>(
+            fixture.name(), fixture.isready(), fixture.displayname(), fixture.productname(), fixture.serialnumber(),
+            fixture.powerstate(), fixture.brightness(), fixture.temperature());
+    remote->_handle = fixture.handle();
+
+    return remote;
+}
+
+// Prefer the handle, the daemon then doesn't have to match a regex per light
+template <typename Request>
+static void setTarget(Request& request, const RemoteFixture& fixture) {
+    if (fixture._handle != 0)
+        request.set_handle(fixture._handle);
+    else
+        request.set_fixturefilter(fixture._name);
+}
+
 bool ElgatoClient::powerOn(std::string fixtureFilter) {
     SimpleCliRequest request;
     SimpleCliResponse response;
@@ -81,6 +97,7 @@ bool ElgatoClient::powerOn(std::string fixtureFilter) {
 
     request.set_fixturefilter(fixtureFilter);
 
+    addClientId(context);
     auto status = _stub->PowerOn(&context, request, &response);
 
     return status.ok() && response.successful();
@@ -93,6 +110,33 @@ bool ElgatoClient::powerOff(std::string fixtureFilter) {
 
     request.set_fixturefilter(fixtureFilter);
 
+    addClientId(context);
+    auto status = _stub->PowerOff(&context, request, &response);
+
+    return status.ok() && response.successful();
+}
+
+bool ElgatoClient::powerOn(const RemoteFixture& fixture) {
+    SimpleCliRequest request;
+    SimpleCliResponse response;
+    ClientContext context;
+
+    setTarget(request, fixture);
+
+    addClientId(context);
+    auto status = _stub->PowerOn(&context, request, &response);
+
+    return status.ok() && response.successful();
+}
+
+bool ElgatoClient::powerOff(const RemoteFixture& fixture) {
+    SimpleCliRequest request;
+    SimpleCliResponse response;
+    ClientContext context;
+
+    setTarget(request, fixture);
+
+    addClientId(context);
     auto status = _stub->PowerOff(&context, request, &response);
 
     return status.ok() && response.successful();
@@ -106,6 +150,7 @@ bool ElgatoClient::setBrightness(std::string fixtureFilter, uint32_t brightness)
     request.set_fixturefilter(fixtureFilter);
     request.set_newvalue(brightness);
 
+    addClientId(context);
     auto status = _stub->SetBrightness(&context, request, &response);
 
     return status.ok() && response.successful();
@@ -120,21 +165,95 @@ bool ElgatoClient::setColorTemp(std::string fixtureFilter, uint32_t colorTemp)
     request.set_fixturefilter(fixtureFilter);
     request.set_newvalue(colorTemp);
 
+    addClientId(context);
     auto status = _stub->SetTemperature(&context, request, &response);
 
     return status.ok() && response.successful();
 }
 
-void ElgatoClient::listenForChanges() {
-    _listenerThread = std::make_unique<std::thread>([this] {
-        ClientContext context;
-        Empty request;
-        FixtureUpdate update;
+bool ElgatoClient::streamControl(const RemoteFixture& fixture, FixtureOperation operation, uint32_t value) {
+    std::lock_guard<std::mutex> lock(_controlMutex);
+
+    ControlCommand command;
+    setTarget(command, fixture);
+    command.set_operation(operation);
+    command.set_value(value);
+
+    // A broken stream is opened again once, e.g. after the daemon restarted
+    for(int attempt = 0; attempt < 2; attempt++) {
+        // The id is sent once when the stream opens, so a new one needs a new stream
+        if (_controlWriter && _controlClientId != clientId()) {
+            _controlWriter->WritesDone();
+            _controlWriter->Finish();
+            _controlWriter.reset();
+        }
+
+        if (!_controlWriter) {
+            _controlContext = std::make_unique<ClientContext>();
+            _controlClientId = clientId();
+            addClientId(*_controlContext);
+            _controlWriter = _stub->StreamControl(_controlContext.get(), &_controlResponse);
+        }
+
+        if (_controlWriter->Write(command))
+            return true;
+
+        _controlWriter->Finish();
+        _controlWriter.reset();
+        _controlContext.reset();
+    }
+
+    return false;
+}
+
+ElgatoClient::~ElgatoClient() {
+    std::lock_guard<std::mutex> lock(_controlMutex);
+    if (!_controlWriter) return;
 
-        auto reader = _stub->ObserveChanges(&context, request);
+    _controlWriter->WritesDone();
+    _controlWriter->Finish();
+}
 
-        while(reader->Read(&update)) {
-            notifyObservers({update.fixturename(), update.propertyname(), update.newvalue()});
+void ElgatoClient::listenForChanges() {
+    _listenerThread = std::make_unique<std::thread>([this] {
+        uint64_t lastSequence = 0;
+
+        // Reconnect after the stream broke and let the daemon replay what was missed in between
+        while(true) {
+            ClientContext context;
+            ObserveRequest request;
+            FixtureUpdate update;
+
+            // Only the latest value matters for the menu and sliders
+            request.set_policy(COALESCE);
+            request.set_resumefrom(lastSequence);
+            auto reader = _stub->ObserveChanges(&context, request);
+
+            while(reader->Read(&update)) {
+                if (update.sequence() > 0)
+                    lastSequence = update.sequence();
+
+                // The first message of every stream carries the id the daemon knows us by
+                if (update.eventtype() == PROPERTY_CHANGED && update.changes_size() == 0 && !update.clientid().empty()) {
+                    std::lock_guard<std::mutex> lock(_clientIdMutex);
+                    _clientId = update.clientid();
+                }
+
+                if (update.resyncrequired() && _resyncCallback)
+                    _resyncCallback();
+
+                if (update.eventtype() == PROPERTY_CHANGED) {
+                    for(auto& change : update.changes()) {
+                        notifyObservers({change.fixturename(), change.property(), change.newvalue()});
+                    }
+                } else if (!update.fixturename().empty()) {
+                    notifyObservers({update.eventtype(), update.fixturename(),
+                                     update.has_fixture() ? fromFixture(update.fixture()) : nullptr});
+                }
+            }
+
+            reader->Finish();
+            std::this_thread::sleep_for(std::chrono::seconds(1));
         }
     });
 
@@ -145,6 +264,22 @@ void ElgatoClient::registerCallback(const std::function<void(const FixtureUpdate
     _callbacks.emplace_back(observer);
 }
 
+std::string ElgatoClient::clientId() {
+    std::lock_guard<std::mutex> lock(_clientIdMutex);
+    return _clientId;
+}
+
+// Lets the daemon skip sending our own changes back to the listener
+void ElgatoClient::addClientId(ClientContext& context) {
+    auto id = clientId();
+    if (!id.empty())
+        context.AddMetadata(CLIENT_ID_METADATA, id);
+}
+
+void ElgatoClient::registerResyncCallback(const std::function<void()>& callback) {
+    _resyncCallback = callback;
+}
+
 void ElgatoClient::notifyObservers(const FixtureUpdateEventArgs& args) {
     if (_callbacks.empty()) return;
 
@@ -28,6 +28,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <grpc/grpc.h>
 #include <grpcpp/channel.h>
@@ -39,21 +40,6 @@
 
 using grpc::Channel;
 
-class FixtureUpdateEventArgs final {
-public:
-    FixtureUpdateEventArgs(std::string fixtureName, std::string propertyName, int32_t newValue)
-        : _fixtureName(std::move(fixtureName)), _propertyName(std::move(propertyName)), _newValue(newValue) { }
-
-    [[nodiscard]] std::string fixtureName() const { return _fixtureName; }
-    [[nodiscard]] std::string propertyName() const { return _propertyName; }
-    [[nodiscard]] int32_t newValue() const { return _newValue; }
-
-private:
-    std::string _fixtureName;
-    std::string _propertyName;
-    int32_t _newValue;
-};
-
 struct RemoteFixture {
     RemoteFixture(std::string name, bool isReady, std::string displayName, std::string productName,
                   std::string serialNumber, bool powerState, int32_t brightness, int32_t temperature) :
@@ -67,6 +53,8 @@ struct RemoteFixture {
         _temperature(temperature) { }
 
     std::string _name;
+    // Assigned by the daemon, 0 when it is too old to hand them out
+    uint32_t _handle = 0;
     bool _isReady;
     std::string _displayName;
     std::string _productName;
@@ -76,28 +64,71 @@ struct RemoteFixture {
     int32_t _temperature;
 };
 
+class FixtureUpdateEventArgs final {
+public:
+    FixtureUpdateEventArgs(std::string fixtureName, FixtureProperty property, int32_t newValue)
+        : _eventType(PROPERTY_CHANGED), _fixtureName(std::move(fixtureName)), _property(property), _newValue(newValue) { }
+
+    FixtureUpdateEventArgs(FixtureEventType eventType, std::string fixtureName, std::shared_ptr<RemoteFixture> fixture)
+        : _eventType(eventType), _fixtureName(std::move(fixtureName)), _property(PROPERTY_UNKNOWN), _newValue(0), _fixture(std::move(fixture)) { }
+
+    [[nodiscard]] FixtureEventType eventType() const { return _eventType; }
+    [[nodiscard]] std::string fixtureName() const { return _fixtureName; }
+    [[nodiscard]] FixtureProperty property() const { return _property; }
+    [[nodiscard]] int32_t newValue() const { return _newValue; }
+    // Only set for FIXTURE_ADDED and FIXTURE_CHANGED
+    [[nodiscard]] std::shared_ptr<RemoteFixture> fixture() const { return _fixture; }
+
+private:
+    FixtureEventType _eventType;
+    std::string _fixtureName;
+    FixtureProperty _property;
+    int32_t _newValue;
+    std::shared_ptr<RemoteFixture> _fixture;
+};
+
 class ElgatoClient final {
 public:
     explicit ElgatoClient(const std::shared_ptr<Channel> &channel) :
         _stub(Elgato::NewStub(channel)),
         _callbacks(std::vector<std::function<void(const FixtureUpdateEventArgs)>>()) { }
+    ~ElgatoClient();
 
     static std::shared_ptr<Channel> createChannel(const std::string&);
+    static std::shared_ptr<RemoteFixture> fromFixture(const Fixture&);
     std::vector<std::shared_ptr<RemoteFixture>> listFixtures();
 
     bool powerOn(std::string);
     bool powerOff(std::string);
+    bool powerOn(const RemoteFixture&);
+    bool powerOff(const RemoteFixture&);
     bool setBrightness(std::string, uint32_t);
     bool setColorTemp(std::string, uint32_t);
+    // Sends through one long lived stream, meant for sliders that change many times a second
+    bool streamControl(const RemoteFixture&, FixtureOperation, uint32_t);
 
     void listenForChanges();
     void registerCallback(const std::function<void(const FixtureUpdateEventArgs)>&);
+    // Called from the listener thread when updates were lost and the fixture list has to be reloaded
+    void registerResyncCallback(const std::function<void()>&);
 private:
     void notifyObservers(const FixtureUpdateEventArgs&);
+    std::string clientId();
+    void addClientId(grpc::ClientContext&);
 
     static std::string expand_with_environment(const std::string& );
     std::unique_ptr<Elgato::Stub> _stub;
     std::vector<std::function<void(const FixtureUpdateEventArgs)>> _callbacks;
+    std::function<void()> _resyncCallback;
 
     std::unique_ptr<std::thread> _listenerThread;
+
+    std::mutex _clientIdMutex;
+    std::string _clientId;
+
+    std::mutex _controlMutex;
+    std::unique_ptr<grpc::ClientContext> _controlContext;
+    std::unique_ptr<grpc::ClientWriter<ControlCommand>> _controlWriter;
+    std::string _controlClientId;
+    SimpleCliResponse _controlResponse;
 };
@@ -48,11 +48,11 @@ void FixtureMenuItem::onPowerToggle() {
     if (_inGuiUpdate) return;
 
     if (_myFixture->_powerState) {
-        if (_elgatoClient->powerOff(_myFixture->_name))
+        if (_elgatoClient->powerOff(*_myFixture))
             _myFixture->_powerState = false;
 
     } else {
-        if (_elgatoClient->powerOn(_myFixture->_name))
+        if (_elgatoClient->powerOn(*_myFixture))
             _myFixture->_powerState = true;
     }
 }
@@ -35,6 +35,7 @@
 class FixtureMenuItem final : public Gtk::MenuItem {
 public:
     FixtureMenuItem(std::shared_ptr<RemoteFixture>&, std::shared_ptr<ElgatoClient>&);
+    [[nodiscard]] std::string fixtureName() const { return _myFixture->_name; }
 
 private:
     virtual void onPowerToggle();
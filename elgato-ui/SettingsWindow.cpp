@@ -67,8 +67,11 @@ void SettingsWindow::refreshFixtures() {
 }
 
 void SettingsWindow::onFixtureChanged(const FixtureUpdateEventArgs& args) {
+    // Added and removed fixtures are handled by the tray, which rebuilds this window
+    if (args.eventType() != PROPERTY_CHANGED) return;
+
 #ifdef DEBUG_BUILD
-    std::cerr << "Fixture Update for " << args.fixtureName() << " prop " << args.propertyName() << " is now " << args.newValue() << std::endl;
+    std::cerr << "Fixture Update for " << args.fixtureName() << " prop " << FixtureProperty_Name(args.property()) << " is now " << args.newValue() << std::endl;
 #endif
 
     for(auto& fixtureItem : _children) {
@@ -143,12 +146,12 @@ void FixtureItem::onPowerToggle() {
 
     _inUpdateFromUi = true;
     if (_fixture->_powerState) {
-        if (_client->powerOff(_fixture->_name)) {
+        if (_client->powerOff(*_fixture)) {
             _fixture->_powerState = false;
         }
     }
     else {
-        if (_client->powerOn(_fixture->_name)) {
+        if (_client->powerOn(*_fixture)) {
             _fixture->_powerState = true;
         }
     }
@@ -161,7 +164,7 @@ void FixtureItem::onBrightnessChanged() {
     _inUpdateFromUi = true;
     auto newValue = (int32_t)std::round(_brightness.get_value());
 
-    if (_client->setBrightness(_fixture->_name, newValue)) {
+    if (_client->streamControl(*_fixture, SET_BRIGHTNESS, newValue)) {
         _fixture->_brightness = newValue;
     }
     _inUpdateFromUi = false;
@@ -173,7 +176,7 @@ void FixtureItem::onColorTempChanged() {
     _inUpdateFromUi = true;
     auto newValue = (int32_t)std::round(_colorTemp.get_value());
 
-    if (_client->setColorTemp(_fixture->_name, newValue)) {
+    if (_client->streamControl(*_fixture, SET_TEMPERATURE, newValue)) {
         _fixture->_temperature = newValue;
     }
     _inUpdateFromUi = false;
@@ -183,29 +186,29 @@ void FixtureItem::refreshFromData(const FixtureUpdateEventArgs& args) {
     if (_inUpdateFromUi) return;
     _inUpdateFromServer = true;
 
-    if (args.propertyName() == "Power") {
-        _fixture->_powerState = args.newValue() == 1;
-        _powerButton.set_active(args.newValue() == 1);
-    }
-
-    if (args.propertyName() == "Brightness") {
-        auto value = args.newValue();
-
-        if (value < 0) value = 0;
-        if (value > 100) value = 100;
-
-        _fixture->_brightness = value;
-        _brightness.set_value(value);
-    }
-
-    if (args.propertyName() == "Temperature") {
-        auto value = args.newValue();
-
-        if (value < 2900) value = 2900;
-        if (value > 7000) value = 7000;
-
-        _fixture->_temperature = value;
-        _colorTemp.set_value(value);
+    auto value = args.newValue();
+
+    switch(args.property()) {
+        case POWER:
+            _fixture->_powerState = value == 1;
+            _powerButton.set_active(value == 1);
+            break;
+        case BRIGHTNESS:
+            if (value < 0) value = 0;
+            if (value > 100) value = 100;
+
+            _fixture->_brightness = value;
+            _brightness.set_value(value);
+            break;
+        case TEMPERATURE:
+            if (value < 2900) value = 2900;
+            if (value > 7000) value = 7000;
+
+            _fixture->_temperature = value;
+            _colorTemp.set_value(value);
+            break;
+        default:
+            break;
     }
 
     _inUpdateFromServer = false;
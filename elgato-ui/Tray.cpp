@@ -24,6 +24,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
 #include <iostream>
 #include "Tray.h"
 #include "../Config.h"
@@ -62,6 +63,12 @@ Tray::Tray(const std::shared_ptr<Channel> &channel)
 
     set_visible(true);
 
+    _fixtureEventDispatcher.connect(sigc::mem_fun(*this, &Tray::onFixtureEventsPending));
+    _client->registerCallback(sigc::mem_fun(*this, &Tray::onFixtureEvent));
+
+    _resyncDispatcher.connect(sigc::mem_fun(*this, &Tray::on_refreshItem_activated));
+    _client->registerResyncCallback([this] { _resyncDispatcher.emit(); });
+
     _client->listenForChanges();
     _refreshListItem.activate();
 }
@@ -92,13 +99,68 @@ void Tray::on_refreshItem_activated() {
     _fixtures->clear();
 
     for(auto& fix : _client->listFixtures()) {
-        auto mItem = std::make_shared<FixtureMenuItem>(fix,_client);
-        mItem->show();
-        _menuItems.push_back(mItem);
-        _fixtures->push_back(fix);
-        _menu.insert(*mItem, 2);
+        addFixture(fix);
+    }
+
+    updateAllItems();
+    _settingsWindow.refreshFixtures();
+}
+
+void Tray::onFixtureEvent(const FixtureUpdateEventArgs& args) {
+    if (args.eventType() == PROPERTY_CHANGED) return;
+
+    std::unique_lock<std::mutex> lock(_pendingEventsMutex);
+    _pendingEvents.push_back(args);
+    lock.unlock();
+
+    _fixtureEventDispatcher.emit();
+}
+
+void Tray::onFixtureEventsPending() {
+    std::unique_lock<std::mutex> lock(_pendingEventsMutex);
+    auto events = std::move(_pendingEvents);
+    _pendingEvents.clear();
+    lock.unlock();
+
+    for(const auto& event : events) {
+        if ((event.eventType() == FIXTURE_ADDED || event.eventType() == FIXTURE_CHANGED) && event.fixture() != nullptr) {
+            auto fix = event.fixture();
+            removeFixture(fix->_name);
+            addFixture(fix);
+        }
+
+        if (event.eventType() == FIXTURE_REMOVED)
+            removeFixture(event.fixtureName());
     }
 
+    updateAllItems();
+    _settingsWindow.refreshFixtures();
+}
+
+void Tray::addFixture(std::shared_ptr<RemoteFixture>& fix) {
+    auto mItem = std::make_shared<FixtureMenuItem>(fix,_client);
+    mItem->show();
+    _menuItems.push_back(mItem);
+    _fixtures->push_back(fix);
+    _menu.insert(*mItem, 2);
+}
+
+void Tray::removeFixture(const std::string& name) {
+    for(auto it = _menuItems.begin(); it != _menuItems.end();) {
+        if ((*it)->fixtureName() == name) {
+            _menu.remove(**it);
+            it = _menuItems.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    _fixtures->erase(std::remove_if(_fixtures->begin(), _fixtures->end(), [&name](const auto& fix) {
+        return fix->_name == name;
+    }), _fixtures->end());
+}
+
+void Tray::updateAllItems() {
     if (_menuItems.empty()) {
         _powerOnAll.hide();
         _powerOffAll.hide();
@@ -106,8 +168,6 @@ void Tray::on_refreshItem_activated() {
         _powerOnAll.show();
         _powerOffAll.show();
     }
-
-    _settingsWindow.refreshFixtures();
 }
 
 void Tray::on_powerOnAll_activated() {
@@ -28,6 +28,7 @@
 #pragma once
 
 #include <gtkmm.h>
+#include <mutex>
 #include <unistd.h>
 
 #include "SettingsWindow.h"
@@ -47,6 +48,12 @@ private:
     virtual void on_powerOnAll_activated();
     virtual void on_powerOffAll_activated();
 
+    void onFixtureEvent(const FixtureUpdateEventArgs&);
+    void onFixtureEventsPending();
+    void addFixture(std::shared_ptr<RemoteFixture>&);
+    void removeFixture(const std::string&);
+    void updateAllItems();
+
     Gtk::Menu _menu;
     Gtk::MenuItem _powerOnAll;
     Gtk::MenuItem _powerOffAll;
@@ -58,4 +65,10 @@ private:
     std::shared_ptr<std::vector<std::shared_ptr<RemoteFixture>>> _fixtures;
 
     SettingsWindow _settingsWindow;
+
+    // Discovery events arrive on the listener thread, widgets may only be touched from the main loop
+    Glib::Dispatcher _fixtureEventDispatcher;
+    std::mutex _pendingEventsMutex;
+    std::vector<FixtureUpdateEventArgs> _pendingEvents;
+    Glib::Dispatcher _resyncDispatcher;
 };
@@ -26,22 +26,25 @@
 
 #include "AvahiBrowser.h"
 #include "Log.h"
+#include "DaemonConfig.h"
 #include "../Config.h"
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <iostream>
 
 #include <avahi-common/error.h>
+#include <avahi-common/malloc.h>
 #include <thread>
 #include <future>
 #include <regex>
 
-void AvahiBrowser::resolveCallback(AvahiServiceResolver* resolver, [[maybe_unused]] AvahiIfIndex interface,
+void AvahiBrowser::resolveCallback(AvahiServiceResolver* resolver, AvahiIfIndex interface,
                                    [[maybe_unused]]AvahiProtocol protocol, AvahiResolverEvent event, const char* name,
                                    const char* type, const char* domain, [[maybe_unused]] const char* hostname,
                                    const AvahiAddress* address, uint16_t port,
-                                   [[maybe_unused]] AvahiStringList* txt, [[maybe_unused]] AvahiLookupResultFlags flags,
+                                   AvahiStringList* txt, [[maybe_unused]] AvahiLookupResultFlags flags,
                                    [[maybe_unused]] void* userdata) {
     assert(resolver);
 
@@ -58,7 +61,17 @@ void AvahiBrowser::resolveCallback(AvahiServiceResolver* resolver, [[maybe_unuse
             char strAddress[AVAHI_ADDRESS_STR_MAX];
             avahi_address_snprint(strAddress, sizeof(strAddress), address);
 
-            auto discoveredLight = std::make_shared<ElgatoLight>(std::string(name), strAddress, port);
+            // The TXT record already tells us what the light is, the rest of accessory-info is fetched on demand
+            auto txtInfo = accessoryFromTxt(txt);
+
+            // Same light on another interface, or back after roaming: no new light and no probes
+            if (getInstance().absorbIfKnown(name, txtInfo != nullptr ? txtInfo->deviceId : "", strAddress, port, interface))
+                break;
+
+            auto discoveredLight = txtInfo != nullptr
+                    ? std::make_shared<ElgatoLight>(std::string(name), strAddress, port, txtInfo, false, interface)
+                    : std::make_shared<ElgatoLight>(std::string(name), strAddress, port, interface);
+
             getInstance().addIfUnknown(discoveredLight);
           break;
     }
@@ -66,6 +79,34 @@ void AvahiBrowser::resolveCallback(AvahiServiceResolver* resolver, [[maybe_unuse
     avahi_service_resolver_free(resolver);
 }
 
+std::shared_ptr<ElgatoAccessoryInfo> AvahiBrowser::accessoryFromTxt(AvahiStringList* txt) {
+    auto info = std::make_shared<ElgatoAccessoryInfo>();
+
+    // Elgato lights announce mf (manufacturer), md (model), dt (board type), id (MAC) and pv (protocol version)
+    for(auto item = txt; item != nullptr; item = avahi_string_list_get_next(item)) {
+        char* key = nullptr;
+        char* value = nullptr;
+
+        if (avahi_string_list_get_pair(item, &key, &value, nullptr) < 0) continue;
+
+        if (value != nullptr) {
+            const std::string keyString(key);
+
+            if (keyString == "md") info->productName = value;
+            if (keyString == "id") info->deviceId = value;
+            if (keyString == "dt") info->hardwareBoardType = (uint16_t)strtoul(value, nullptr, 10);
+        }
+
+        avahi_free(key);
+        avahi_free(value);
+    }
+
+    if (info->productName.empty())
+        return nullptr;
+
+    return info;
+}
+
 void AvahiBrowser::browseCallback(AvahiServiceBrowser* browser, AvahiIfIndex interface, AvahiProtocol protocol,
                                   AvahiBrowserEvent event, const char* name, const char* type, const char * domain,
                                   [[maybe_unused]] AvahiLookupResultFlags flags, void* userdata) {
@@ -84,9 +125,7 @@ void AvahiBrowser::browseCallback(AvahiServiceBrowser* browser, AvahiIfIndex int
                         avahi_client_errno(client)) << std::endl;
             break;
         case AVAHI_BROWSER_REMOVE:
-            getInstance().removeByName(name);
-            AvahiBrowser::getInstance().notifyObservers({ AvahiBrowserEventType::LIGHT_REMOVED, name});
-
+            getInstance().removePath(name, interface);
             break;
         case AVAHI_BROWSER_CACHE_EXHAUSTED:
         case AVAHI_BROWSER_ALL_FOR_NOW:
@@ -133,27 +172,160 @@ void AvahiBrowser::threadStart() {
     avahi_simple_poll_loop(getInstance()._simple_poll);
 }
 
-void AvahiBrowser::addIfUnknown(std::shared_ptr<ElgatoLight>& light) {
+bool AvahiBrowser::addIfUnknown(std::shared_ptr<ElgatoLight>& light) {
+    std::unique_lock<std::mutex> lock(_lightsMutex);
+
+    // A light found by the subnet sweep and by mDNS has different names, but the same address or serial number. Lights
+    // built from the TXT record have no serial number until they were probed, so the address is checked first
+    auto address = light->address();
+    auto port = light->port();
     auto item = std::find_if(_lights.begin(), _lights.end(),
-                             [light](const std::shared_ptr<ElgatoLight>& item) {
-        return item->name() == light->name();
+                             [light, address, port](const std::shared_ptr<ElgatoLight>& item) {
+        if (item->name() == light->name()) return true;
+
+        auto paths = item->paths();
+        if (std::any_of(paths.begin(), paths.end(), [address, port](const auto& path) {
+            return path.address.s_addr == address.s_addr && path.port == port;
+        }))
+            return true;
+
+        auto itemInfo = item->cachedDeviceInfo();
+        auto lightInfo = light->cachedDeviceInfo();
+
+        return itemInfo != nullptr && lightInfo != nullptr &&
+               !itemInfo->serialNumber.empty() && itemInfo->serialNumber == lightInfo->serialNumber;
     });
 
     if (item == _lights.end()) {
+        auto& handle = _handles[light->name()];
+        if (handle == 0) handle = _nextHandle++;
+
+        light->setHandle(handle);
+        light->setChangeListener([this, name = light->name()] {
+            notifyObservers({AvahiBrowserEventType::LIGHT_CHANGED, name});
+        });
+        _lightsByHandle[handle] = light;
         _lights.push_back(light);
         notifyObservers({AvahiBrowserEventType::LIGHT_ADDED, light->name()});
+        return true;
+    }
+
+    return false;
+}
+
+void AvahiBrowser::removePath(const std::string& name, int interfaceIndex) {
+    std::unique_lock<std::mutex> lock(_lightsMutex);
+    auto item = std::find_if(_lights.begin(), _lights.end(), [&name](const auto& item) { return item->name() == name; });
+    if (item == _lights.end()) return;
+
+    // Still reachable through another interface
+    if ((*item)->removePath(interfaceIndex) > 0) return;
+
+    auto lossCount = (*item)->markLost();
+    lock.unlock();
+
+    auto graceMs = DaemonConfig::getInstance().discoveryGraceMs;
+    if (graceMs == 0) {
+        expireLost(name, lossCount);
+        return;
+    }
+
+    scheduleExpiry(name, lossCount, std::chrono::steady_clock::now() + std::chrono::milliseconds(graceMs));
+}
+
+void AvahiBrowser::scheduleExpiry(const std::string& name, uint32_t lossCount, std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(_expiryMutex);
+    if (_stopping) return;
+
+    _expiries.emplace(deadline, PendingExpiry{name, lossCount});
+    if (!_expiryThread.joinable()) _expiryThread = std::thread(&AvahiBrowser::expireDue, this);
+    lock.unlock();
+
+    _expiryCond.notify_one();
+}
+
+void AvahiBrowser::expireDue() {
+    std::unique_lock<std::mutex> lock(_expiryMutex);
+
+    while(!_stopping) {
+        if (_expiries.empty()) {
+            _expiryCond.wait(lock);
+            continue;
+        }
+
+        auto next = _expiries.begin();
+        if (next->first > std::chrono::steady_clock::now()) {
+            _expiryCond.wait_until(lock, next->first);
+            continue;
+        }
+
+        auto expiry = next->second;
+        _expiries.erase(next);
+        lock.unlock();
+
+        expireLost(expiry.name, expiry.lossCount);
+
+        lock.lock();
     }
 }
 
-void AvahiBrowser::removeByName(std::string name) {
-    _lights.erase(
-            std::remove_if(_lights.begin(), _lights.end(),
-                           [name](const std::shared_ptr<ElgatoLight>& item) {
-                return item->name() == name;
-            }), _lights.end());
+void AvahiBrowser::fetchDeviceInfo(const std::shared_ptr<ElgatoLight>& light) {
+    if (!light->claimInfoFetch()) return;
+
+    // Finishing the fetch notifies LIGHT_CHANGED, which sends the complete fixture
+    _probes.submit([light] {
+        light->deviceInfo();
+        light->releaseInfoFetch();
+    });
+}
+
+void AvahiBrowser::expireLost(const std::string& name, uint32_t lossCount) {
+    std::unique_lock<std::mutex> lock(_lightsMutex);
+    auto item = std::find_if(_lights.begin(), _lights.end(), [&name](const auto& item) { return item->name() == name; });
+
+    // Revived in the meantime, or lost again and a newer timer is responsible
+    if (item == _lights.end() || !(*item)->isLost() || (*item)->lossCount() != lossCount) return;
+
+    _lightsByHandle.erase((*item)->handle());
+    _lights.erase(item);
+    _lightsExpired++;
+    notifyObservers({AvahiBrowserEventType::LIGHT_REMOVED, name});
+}
+
+bool AvahiBrowser::absorbIfKnown(const std::string& name, const std::string& deviceId, const char* address, uint16_t port, int interfaceIndex) {
+    std::unique_lock<std::mutex> lock(_lightsMutex);
+    auto item = std::find_if(_lights.begin(), _lights.end(), [&name, &deviceId](const auto& item) {
+        if (item->name() == name) return true;
+
+        auto info = item->cachedDeviceInfo();
+        return !deviceId.empty() && info != nullptr && info->deviceId == deviceId;
+    });
+
+    if (item == _lights.end()) return false;
+
+    auto light = *item;
+    lock.unlock();
+
+    if (light->isLost()) {
+        light->revive(address, port, interfaceIndex);
+        _flapsAbsorbed++;
+
+        std::clog << kLogInfo << "(AvahiBrowser) " << name << " is back at " << address << ", keeping its state." << std::endl;
+        return true;
+    }
+
+    light->addPath(address, port, interfaceIndex);
+    _duplicatesSkipped++;
+
+#if DEBUG_BUILD
+    std::clog << kLogDebug << "(AvahiBrowser) " << name << " also reachable at " << address << ", now using " << light->portString() << std::endl;
+#endif
+
+    return true;
 }
 
 std::shared_ptr<ElgatoLight> AvahiBrowser::firstByName(const std::string &regexPattern) {
+    std::lock_guard<std::mutex> lock(_lightsMutex);
     auto item = std::find_if(_lights.begin(), _lights.end(), [regexPattern](const auto& item) {
         const std::regex pattern(regexPattern);
         return std::regex_search(item->name(), pattern);
@@ -165,10 +337,18 @@ std::shared_ptr<ElgatoLight> AvahiBrowser::firstByName(const std::string &regexP
     return *item;
 }
 
+std::shared_ptr<ElgatoLight> AvahiBrowser::exactlyNamed(const std::string& name) {
+    std::lock_guard<std::mutex> lock(_lightsMutex);
+    auto item = std::find_if(_lights.begin(), _lights.end(), [&name](const auto& item) { return item->name() == name; });
+
+    return item == _lights.end() ? nullptr : *item;
+}
+
 std::vector<std::shared_ptr<ElgatoLight>> AvahiBrowser::allByName(const std::string &regexPattern) {
     std::vector<std::shared_ptr<ElgatoLight>> target;
     const std::regex pattern(regexPattern == "*" ? "." : regexPattern);
 
+    std::lock_guard<std::mutex> lock(_lightsMutex);
     for(auto& item : _lights){
         if (std::regex_search(item->name(), pattern))
             target.push_back(item);
@@ -177,6 +357,29 @@ std::vector<std::shared_ptr<ElgatoLight>> AvahiBrowser::allByName(const std::str
     return target;
 }
 
+std::shared_ptr<ElgatoLight> AvahiBrowser::byHandle(uint32_t handle) {
+    std::lock_guard<std::mutex> lock(_lightsMutex);
+    auto item = _lightsByHandle.find(handle);
+
+    return item == _lightsByHandle.end() ? nullptr : item->second;
+}
+
+uint32_t AvahiBrowser::handleOf(const std::string& name) {
+    std::lock_guard<std::mutex> lock(_lightsMutex);
+    auto item = _handles.find(name);
+
+    return item == _handles.end() ? 0 : item->second;
+}
+
+AvahiBrowser::~AvahiBrowser() {
+    std::unique_lock<std::mutex> lock(_expiryMutex);
+    _stopping = true;
+    lock.unlock();
+    _expiryCond.notify_all();
+
+    if (_expiryThread.joinable()) _expiryThread.join();
+}
+
 void AvahiBrowser::cleanUp() {
     if (_workerThread) {
         pthread_cancel(_workerThread->native_handle());
@@ -205,10 +408,34 @@ void AvahiBrowser::registerCallback(const std::function<void(const AvahiBrowserE
 void AvahiBrowser::notifyObservers(const AvahiBrowserEventArgs& args) {
     if (_callbacks.empty()) return;
 
-    std::thread caller([args, this]{
+    std::unique_lock<std::mutex> lock(_eventMutex);
+    _events.push_back(args);
+
+    if (!_dispatching) {
+        _dispatching = true;
+        std::thread dispatcher([this] { dispatchEvents(); });
+        dispatcher.detach();
+    }
+
+    lock.unlock();
+    _eventCond.notify_one();
+}
+
+// A single thread for the lifetime of the daemon, so observers see a light added before it is removed
+void AvahiBrowser::dispatchEvents() {
+    std::unique_lock<std::mutex> lock(_eventMutex);
+
+    while(true) {
+        _eventCond.wait(lock, [this] { return !_events.empty(); });
+
+        auto args = _events.front();
+        _events.pop_front();
+        lock.unlock();
+
         for(const auto& callback : _callbacks) {
             callback(args);
         }
-    });
-    caller.detach();
+
+        lock.lock();
+    }
 }
\ No newline at end of file
@@ -27,19 +27,29 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <string>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <avahi-common/simple-watch.h>
 #include <avahi-client/lookup.h>
 
 #include "ElgatoLight.h"
+#include "WorkerPool.h"
 
 enum class AvahiBrowserEventType {
     LIGHT_ADDED,
-    LIGHT_REMOVED
+    LIGHT_REMOVED,
+    // Info, state or reachability changed without a write, e.g. a probe finished or the light went missing
+    LIGHT_CHANGED
 };
 
 struct AvahiBrowserEventArgs {
@@ -62,16 +72,38 @@ public:
 
     AvahiBrowser(const AvahiBrowser&) = delete;
     AvahiBrowser& operator=(const AvahiBrowser&) = delete;
-    std::vector<std::shared_ptr<ElgatoLight>> getLights() { return _lights; }
+    std::vector<std::shared_ptr<ElgatoLight>> getLights() {
+        std::lock_guard<std::mutex> lock(_lightsMutex);
+        return _lights;
+    }
 
     void start();
     void restart();
 
     void registerCallback(const std::function<void(const AvahiBrowserEventArgs&)>&);
     std::shared_ptr<ElgatoLight> firstByName(const std::string& name);
+    std::shared_ptr<ElgatoLight> exactlyNamed(const std::string& name);
     std::vector<std::shared_ptr<ElgatoLight>> allByName(const std::string& name);
+    std::shared_ptr<ElgatoLight> byHandle(uint32_t handle);
+    // A name keeps its handle for the lifetime of the daemon, even after the light was removed. 0 if it never had one.
+    uint32_t handleOf(const std::string& name);
+
+    // Also used by the SubnetScanner so both discovery paths share one registry. False if the light was known already
+    bool addIfUnknown(std::shared_ptr<ElgatoLight>&);
+    // Updates the path of a known light, or revives it if it was lost. False if neither name nor device id is known
+    bool absorbIfKnown(const std::string& name, const std::string& deviceId, const char* address, uint16_t port, int interfaceIndex);
+    // Marks the light lost once its last path is gone
+    void removePath(const std::string& name, int interfaceIndex);
+    // Fetches the rest of accessory-info for a light built from the TXT record on the prober threads, at most once per
+    // light. Called when a client first asks for the light, so discovery itself only reads the state.
+    void fetchDeviceInfo(const std::shared_ptr<ElgatoLight>&);
+
+    [[nodiscard]] uint64_t flapsAbsorbed() const { return _flapsAbsorbed; }
+    [[nodiscard]] uint64_t lightsExpired() const { return _lightsExpired; }
+    [[nodiscard]] uint64_t duplicatesSkipped() const { return _duplicatesSkipped; }
 private:
     AvahiBrowser() = default;
+    ~AvahiBrowser();
 
     static void resolveCallback(AvahiServiceResolver*, AvahiIfIndex, AvahiProtocol,
                          AvahiResolverEvent, const char*, const char*, const char*, const char*, const AvahiAddress*,
@@ -79,21 +111,54 @@ private:
     static void browseCallback(AvahiServiceBrowser*, AvahiIfIndex, AvahiProtocol, AvahiBrowserEvent, const char* , const char*,
                         const char*, AvahiLookupResultFlags, void*);
     static void clientCallback(AvahiClient*, AvahiClientState, void*);
+    static std::shared_ptr<ElgatoAccessoryInfo> accessoryFromTxt(AvahiStringList*);
     static void threadStart();
     void cleanUp();
 
-    void addIfUnknown(std::shared_ptr<ElgatoLight>&);
-    void removeByName(std::string);
+    void expireLost(const std::string&, uint32_t);
+    // Lost lights are expired by one timer thread, started with the first loss and joined on destruction
+    void scheduleExpiry(const std::string&, uint32_t, std::chrono::steady_clock::time_point);
+    void expireDue();
 
+    // Queues the event for the dispatch thread, callers hold _lightsMutex so events leave in the order the registry changed
     void notifyObservers(const AvahiBrowserEventArgs&);
+    void dispatchEvents();
 
+    std::mutex _lightsMutex;
     std::vector<std::shared_ptr<ElgatoLight>> _lights = {};
+    std::unordered_map<uint32_t, std::shared_ptr<ElgatoLight>> _lightsByHandle = {};
+    std::map<std::string, uint32_t> _handles = {};
+    uint32_t _nextHandle = 1;
     std::vector<std::function<void(const AvahiBrowserEventArgs&)>> _callbacks = {};
 
+    std::mutex _eventMutex;
+    std::condition_variable _eventCond;
+    std::deque<AvahiBrowserEventArgs> _events = {};
+    bool _dispatching = false;
+
+    struct PendingExpiry {
+        std::string name;
+        uint32_t lossCount;
+    };
+
+    std::mutex _expiryMutex;
+    std::condition_variable _expiryCond;
+    std::multimap<std::chrono::steady_clock::time_point, PendingExpiry> _expiries = {};
+    bool _stopping = false;
+    std::thread _expiryThread;
+
+    std::atomic<uint64_t> _flapsAbsorbed = 0;
+    std::atomic<uint64_t> _lightsExpired = 0;
+    std::atomic<uint64_t> _duplicatesSkipped = 0;
+
     std::thread* _workerThread = nullptr;
     AvahiSimplePoll* _simple_poll = nullptr;
     AvahiClient* _client = NULL;
     AvahiServiceBrowser* _browser = NULL;
 
+    // Declared last so it is joined before anything its jobs use goes away
+    static constexpr size_t kProbeThreads = 2;
+    WorkerPool _probes{kProbeThreads};
+
 public:
 };
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Fixed size ring of published items. Every item gets the next sequence number (starting at firstSequence) and
+// readers only keep the sequence of the last item they have seen, so publishing never depends on the number of readers.
+template <typename T>
+class BroadcastRing {
+public:
+    enum class ReadResult { Ok, Empty, Overrun };
+
+    explicit BroadcastRing(size_t capacity, uint64_t firstSequence = 1)
+        : _slots(capacity > 0 ? capacity : 1), _first(firstSequence > 0 ? firstSequence : 1), _head(_first - 1) { };
+
+    uint64_t publish(T item) {
+        std::unique_lock<std::mutex> mlock(_mutex);
+        auto sequence = ++_head;
+        _slots[sequence % _slots.size()] = std::move(item);
+        mlock.unlock();
+        _cond.notify_all();
+
+        return sequence;
+    }
+
+    // make builds the item from its sequence number while the ring is locked
+    template <typename Make>
+    uint64_t publishWith(Make make) {
+        std::unique_lock<std::mutex> mlock(_mutex);
+        auto sequence = ++_head;
+        _slots[sequence % _slots.size()] = make(sequence);
+        mlock.unlock();
+        _cond.notify_all();
+
+        return sequence;
+    }
+
+    uint64_t head() const {
+        std::unique_lock<std::mutex> mlock(_mutex);
+        return _head;
+    }
+
+    // Oldest sequence that can still be read
+    uint64_t oldest() const {
+        std::unique_lock<std::mutex> mlock(_mutex);
+        return oldestLocked();
+    }
+
+    size_t capacity() const {
+        return _slots.size();
+    }
+
+    // Reads the item following cursor and advances cursor to it. On Overrun cursor is left untouched.
+    ReadResult read(uint64_t& cursor, T& item) const {
+        std::unique_lock<std::mutex> mlock(_mutex);
+        if (cursor >= _head) return ReadResult::Empty;
+        if (cursor + 1 < oldestLocked()) return ReadResult::Overrun;
+
+        item = _slots[(cursor + 1) % _slots.size()];
+        cursor++;
+        return ReadResult::Ok;
+    }
+
+    // Waits until something after cursor has been published, returns false on timeout
+    bool waitFor(uint64_t cursor, std::chrono::milliseconds timeout) const {
+        std::unique_lock<std::mutex> mlock(_mutex);
+        return _cond.wait_for(mlock, timeout, [this, cursor] { return _head > cursor; });
+    }
+
+private:
+    uint64_t oldestLocked() const {
+        return _head - _first + 1 >= _slots.size() ? _head - _slots.size() + 1 : _first;
+    }
+
+    std::vector<T> _slots;
+    uint64_t _first;
+    uint64_t _head;
+    mutable std::mutex _mutex;
+    mutable std::condition_variable _cond;
+};
\ No newline at end of file
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "DaemonConfig.h"
+#include "Log.h"
+
+#include <fstream>
+#include <iostream>
+
+using json = nlohmann::json;
+
+void DaemonConfig::load(const std::string& configFile) {
+    auto path = expand_with_environment(configFile);
+    std::ifstream input(path);
+
+    if (!input.is_open()) {
+        std::clog << kLogNotice << "(Config) No config file at " << path << ", using defaults." << std::endl;
+        return;
+    }
+
+    try {
+        json::parse(input).get_to(*this);
+        std::clog << kLogInfo << "(Config) Loaded " << path << std::endl;
+    } catch (const std::exception& e) {
+        std::clog << kLogErr << "(Config) Failed to parse " << path << ": " << e.what() << std::endl;
+    }
+}
+
+std::string DaemonConfig::expand_with_environment(const std::string &s) {
+    if ( s.find("$[") == std::string::npos) return s;
+
+    std::string pre     = s.substr( 0, s.find("$["));
+    std::string post    = s.substr( s.find("$[")+ 2);
+
+    if (post.find(']') == std::string::npos) return s;
+    std::string variable = post.substr( 0, post.find( ']' ) );
+    std::string value   = "";
+
+    post = post.substr(post.find(']') + 1);
+    const char *v = getenv( variable.c_str() );
+    if ( v != NULL ) value = std::string( v );
+
+    return expand_with_environment(pre + value + post);
+}
+
+void from_json(const json& js, DaemonConfig& config) {
+    config.scanSubnet = js.value("scanSubnet", config.scanSubnet);
+    config.scanPort = js.value("scanPort", config.scanPort);
+    config.scanConcurrency = js.value("scanConcurrency", config.scanConcurrency);
+    config.scanTimeoutMs = js.value("scanTimeoutMs", config.scanTimeoutMs);
+    config.scanIntervalMs = js.value("scanIntervalMs", config.scanIntervalMs);
+    config.discoveryGraceMs = js.value("discoveryGraceMs", config.discoveryGraceMs);
+    config.serverMode = js.value("serverMode", config.serverMode);
+    config.completionQueues = js.value("completionQueues", config.completionQueues);
+    config.pollingThreads = js.value("pollingThreads", config.pollingThreads);
+    config.workerThreads = js.value("workerThreads", config.workerThreads);
+    config.updateBacklog = js.value("updateBacklog", config.updateBacklog);
+    config.subscriberPolicy = js.value("subscriberPolicy", config.subscriberPolicy);
+    config.subscriberCapacity = js.value("subscriberCapacity", config.subscriberCapacity);
+    config.clientRate = js.value("clientRate", config.clientRate);
+    config.clientBurst = js.value("clientBurst", config.clientBurst);
+    config.totalClientRate = js.value("totalClientRate", config.totalClientRate);
+    config.totalClientBurst = js.value("totalClientBurst", config.totalClientBurst);
+    config.maxInflightOperations = js.value("maxInflightOperations", config.maxInflightOperations);
+    config.lightWriteRate = js.value("lightWriteRate", config.lightWriteRate);
+    config.lightWriteBurst = js.value("lightWriteBurst", config.lightWriteBurst);
+    config.writeElisionMaxAgeMs = js.value("writeElisionMaxAgeMs", config.writeElisionMaxAgeMs);
+    config.hedgeWrites = js.value("hedgeWrites", config.hedgeWrites);
+    config.hedgeMinDelayMs = js.value("hedgeMinDelayMs", config.hedgeMinDelayMs);
+    config.requestTimeoutFloorMs = js.value("requestTimeoutFloorMs", config.requestTimeoutFloorMs);
+    config.requestTimeoutCeilingMs = js.value("requestTimeoutCeilingMs", config.requestTimeoutCeilingMs);
+    config.connectTimeoutFloorMs = js.value("connectTimeoutFloorMs", config.connectTimeoutFloorMs);
+    config.connectTimeoutCeilingMs = js.value("connectTimeoutCeilingMs", config.connectTimeoutCeilingMs);
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+class DaemonConfig final {
+public:
+    static DaemonConfig& getInstance() {
+        static DaemonConfig instance;
+        return instance;
+    }
+
+    DaemonConfig(const DaemonConfig&) = delete;
+    DaemonConfig& operator=(const DaemonConfig&) = delete;
+
+    void load(const std::string& configFile);
+
+    static std::string expand_with_environment(const std::string&);
+
+    // Active subnet sweep, used as a fallback when mDNS is not available (e.g. "192.168.1.0/24")
+    std::string scanSubnet = {};
+    uint16_t scanPort = 9123;
+    uint16_t scanConcurrency = 64;
+    uint32_t scanTimeoutMs = 300;
+    // Sweeps again after this long to follow lights to new addresses and drop the ones that are gone, 0 sweeps only at
+    // start and on refresh
+    uint32_t scanIntervalMs = 300000;
+
+    // How long a light that left mDNS is kept before it is dropped, 0 drops it right away
+    uint32_t discoveryGraceMs = 15000;
+
+    // "async" serves every call from a few completion queue threads, "sync" uses one thread per call
+    std::string serverMode = "async";
+    uint16_t completionQueues = 2;
+    uint16_t pollingThreads = 2;
+    // Run the calls that wait for lights, so they bound how many of those run at once
+    uint16_t workerThreads = 16;
+
+    // Number of fixture updates kept for subscribers that fall behind
+    uint32_t updateBacklog = 1024;
+
+    // Used for subscribers that don't ask for their own, policy is one of "dropOldest", "coalesce" or "disconnect"
+    std::string subscriberPolicy = "coalesce";
+    uint32_t subscriberCapacity = 256;
+
+    // Control requests per second and burst allowed for each client, 0 disables the quota
+    double clientRate = 20;
+    double clientBurst = 40;
+    // Shared by all clients, so made up client ids can't add up to more than this
+    double totalClientRate = 100;
+    double totalClientBurst = 200;
+    // Operations on lights running at the same time over all clients, 0 for no limit. A request targeting three
+    // lights counts three times
+    uint32_t maxInflightOperations = 64;
+
+    // PUTs per second and burst each light gets, writes above it are merged. 0 disables the limit
+    double lightWriteRate = 5;
+    double lightWriteBurst = 2;
+
+    // A write is skipped if the light's state shows the value and was read at most this long ago, 0 always writes
+    uint32_t writeElisionMaxAgeMs = 5000;
+
+    // Sends a write a second time on a new connection if the light didn't answer within its p95, but at least
+    // hedgeMinDelayMs. The first answer wins.
+    bool hedgeWrites = false;
+    uint32_t hedgeMinDelayMs = 20;
+
+    // Timeouts follow each light's smoothed round trip time plus four times its variation, within these bounds.
+    // A light that has not answered yet gets the ceiling, every timeout doubles the next one until an answer arrives.
+    // Lights answer the odd request only after 1-2 s, the request floor keeps those from failing.
+    uint32_t requestTimeoutFloorMs = 2000;
+    uint32_t requestTimeoutCeilingMs = 5000;
+    uint32_t connectTimeoutFloorMs = 100;
+    uint32_t connectTimeoutCeilingMs = 1000;
+
+private:
+    DaemonConfig() = default;
+};
+
+void from_json(const nlohmann::json&, DaemonConfig&);
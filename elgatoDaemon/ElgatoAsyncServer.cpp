@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <grpc/support/time.h>
+#include <grpcpp/alarm.h>
+#include <grpcpp/security/server_credentials.h>
+#include <mutex>
+
+#include "ElgatoAsyncServer.h"
+#include "ElgatoServerImpl.h"
+#include "Log.h"
+
+using ::grpc::ServerCompletionQueue;
+using ::grpc::ServerContext;
+using ::grpc::Status;
+
+namespace {
+
+// One pending call per unary method and queue, the work itself is done by ElgatoServerImpl. Calls with workers run
+// there and finish from the worker thread
+template <typename Request, typename Response>
+class UnaryCall final : public ElgatoAsyncServer::AsyncCall {
+public:
+    using RequestMethod = void (ElgatoAsyncServer::Service::*)(ServerContext*, Request*, ::grpc::ServerAsyncResponseWriter<Response>*,
+                                                         ::grpc::CompletionQueue*, ServerCompletionQueue*, void*);
+    using Handler = Status (ElgatoServerImpl::*)(ServerContext*, const Request*, Response*);
+
+    UnaryCall(ElgatoAsyncServer::Service* service, ServerCompletionQueue* queue, ElgatoServerImpl* impl, RequestMethod requestMethod, Handler handler,
+              WorkerPool* workers = nullptr)
+        : _service(service), _queue(queue), _impl(impl), _requestMethod(requestMethod), _handler(handler), _workers(workers), _responder(&_context) {
+        (_service->*_requestMethod)(&_context, &_request, &_responder, _queue, _queue, &_tag);
+    }
+
+    void proceed(bool ok, [[maybe_unused]] ElgatoAsyncServer::AsyncTag* tag) override {
+        if (!ok || _finished) {
+            delete this;
+            return;
+        }
+
+        new UnaryCall(_service, _queue, _impl, _requestMethod, _handler, _workers);
+
+        if (_workers)
+            _workers->submit([this] { handle(); });
+        else
+            handle();
+    }
+
+private:
+    void handle() {
+        Status status;
+
+        try {
+            status = (_impl->*_handler)(&_context, &_request, &_response);
+        } catch (const std::exception& e) {
+            std::clog << kLogErr << "RPC handler failed: " << e.what() << std::endl;
+            status = { ::grpc::StatusCode::INTERNAL, e.what() };
+        } catch (...) {
+            std::clog << kLogErr << "RPC handler failed" << std::endl;
+            status = { ::grpc::StatusCode::INTERNAL, "Internal error" };
+        }
+
+        _finished = true;
+        _responder.Finish(_response, status, &_tag);
+    }
+
+    ElgatoAsyncServer::Service* _service;
+    ServerCompletionQueue* _queue;
+    ElgatoServerImpl* _impl;
+    RequestMethod _requestMethod;
+    Handler _handler;
+    WorkerPool* _workers;
+
+    ServerContext _context;
+    Request _request;
+    Response _response;
+    ::grpc::ServerAsyncResponseWriter<Response> _responder;
+
+    bool _finished = false;
+    ElgatoAsyncServer::AsyncTag _tag = { this };
+};
+
+// Reads commands until the client closes its side, each one is only queued on the light
+class StreamControlCall final : public ElgatoAsyncServer::AsyncCall {
+public:
+    StreamControlCall(ElgatoAsyncServer::Service* service, ServerCompletionQueue* queue, ElgatoServerImpl* impl)
+        : _service(service), _queue(queue), _impl(impl), _reader(&_context) {
+        _service->RequestStreamControl(&_context, &_reader, _queue, _queue, &_tag);
+    }
+
+    void proceed(bool ok, [[maybe_unused]] ElgatoAsyncServer::AsyncTag* tag) override {
+        switch(_state) {
+            case State::Requested:
+                if (!ok) break;
+
+                new StreamControlCall(_service, _queue, _impl);
+                _clientId = ElgatoServerImpl::clientIdOf(&_context);
+                _state = State::Reading;
+                _reader.Read(&_command, &_tag);
+                return;
+            case State::Reading:
+                if (ok) {
+                    auto status = _impl->queueControl(_command, _clientId);
+                    if (status.ok()) {
+                        _reader.Read(&_command, &_tag);
+                        return;
+                    }
+
+                    _state = State::Finishing;
+                    _reader.FinishWithError(status, &_tag);
+                    return;
+                }
+
+                _state = State::Finishing;
+                _response.set_successful(true);
+                _reader.Finish(_response, Status::OK, &_tag);
+                return;
+            case State::Finishing:
+                break;
+        }
+
+        delete this;
+    }
+
+private:
+    enum class State { Requested, Reading, Finishing };
+
+    ElgatoAsyncServer::Service* _service;
+    ServerCompletionQueue* _queue;
+    ElgatoServerImpl* _impl;
+
+    ServerContext _context;
+    ControlCommand _command;
+    std::string _clientId;
+    SimpleCliResponse _response;
+    ::grpc::ServerAsyncReader<SimpleCliResponse, ControlCommand> _reader;
+
+    State _state = State::Requested;
+    ElgatoAsyncServer::AsyncTag _tag = { this };
+};
+
+// Writes one page at a time, the next one only after the client took the previous one
+class StreamFixturesCall final : public ElgatoAsyncServer::AsyncCall {
+public:
+    StreamFixturesCall(ElgatoAsyncServer::Service* service, ServerCompletionQueue* queue, ElgatoServerImpl* impl)
+        : _service(service), _queue(queue), _impl(impl), _writer(&_context) {
+        _service->RequestStreamFixtures(&_context, &_request, &_writer, _queue, _queue, &_tag);
+    }
+
+    void proceed(bool ok, [[maybe_unused]] ElgatoAsyncServer::AsyncTag* tag) override {
+        switch(_state) {
+            case State::Requested: {
+                if (!ok) break;
+
+                new StreamFixturesCall(_service, _queue, _impl);
+
+                auto status = ElgatoServerImpl::pageableLights(_request, _lights);
+                if (!status.ok()) {
+                    _state = State::Finishing;
+                    _writer.Finish(status, &_tag);
+                    return;
+                }
+
+                _state = State::Writing;
+                writeNext();
+                return;
+            }
+            case State::Writing:
+                if (!ok) {
+                    _state = State::Finishing;
+                    _writer.Finish(Status::CANCELLED, &_tag);
+                    return;
+                }
+
+                writeNext();
+                return;
+            case State::Finishing:
+                break;
+        }
+
+        delete this;
+    }
+
+private:
+    enum class State { Requested, Writing, Finishing };
+
+    void writeNext() {
+        if (_offset >= _lights.size()) {
+            _state = State::Finishing;
+            _writer.Finish(Status::OK, &_tag);
+            return;
+        }
+
+        _page.Clear();
+        _offset = ElgatoServerImpl::fillPage(_request, _lights, _offset, ElgatoServerImpl::kStreamPageSize, &_page);
+        _writer.Write(_page, &_tag);
+    }
+
+    ElgatoAsyncServer::Service* _service;
+    ServerCompletionQueue* _queue;
+    ElgatoServerImpl* _impl;
+
+    ServerContext _context;
+    ListFixturesRequest _request;
+    FixturePage _page;
+    ::grpc::ServerAsyncWriter<FixturePage> _writer;
+
+    std::vector<std::shared_ptr<ElgatoLight>> _lights;
+    size_t _offset = 0;
+
+    State _state = State::Requested;
+    ElgatoAsyncServer::AsyncTag _tag = { this };
+};
+
+// Parks without a thread while the client has nothing to read, a publish wakes it through an alarm
+class ObserveChangesCall final : public ElgatoAsyncServer::AsyncCall {
+public:
+    ObserveChangesCall(ElgatoAsyncServer::Service* service, ServerCompletionQueue* queue, ElgatoServerImpl* impl)
+        : _service(service), _queue(queue), _impl(impl), _writer(&_context) {
+        _context.AsyncNotifyWhenDone(&_doneTag);
+        _service->RequestObserveChanges(&_context, &_request, &_writer, _queue, _queue, &_requestTag);
+    }
+
+    void proceed(bool ok, ElgatoAsyncServer::AsyncTag* tag) override {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (tag == &_requestTag) {
+            if (!ok) {
+                lock.unlock();
+                delete this;
+                return;
+            }
+
+            new ObserveChangesCall(_service, _queue, _impl);
+
+            // wake() is called with the connection list locked, so never subscribe while holding our own lock
+            lock.unlock();
+            auto connection = _impl->subscribe(_request, [this] { wake(); });
+            lock.lock();
+
+            _connection = connection;
+            _writing = true;
+
+            if (connection == nullptr) {
+                _finishing = true;
+                _writer.Finish({ ::grpc::StatusCode::INVALID_ARGUMENT, "Invalid fixture filter" }, &_writeTag);
+                return;
+            }
+
+            _writer.Write(connection->helloMessage(), &_writeTag);
+            return;
+        }
+
+        if (tag == &_doneTag) _done = true;
+
+        if (tag == &_writeTag) {
+            _writing = false;
+            if (!ok) _broken = true;
+        }
+
+        if (tag == &_alarmTag) _alarmPending = false;
+
+        if (!_done && !_broken && !_finishing) writeNext();
+
+        if (_done && !_writing && !_alarmPending) {
+            auto clientId = _connection != nullptr ? _connection->clientId() : "";
+            lock.unlock();
+
+            if (!clientId.empty()) _impl->unsubscribe(clientId);
+            delete this;
+        }
+    }
+
+private:
+    // Called with _mutex held
+    void writeNext() {
+        if (_writing || _alarmPending) return;
+
+        if (_connection->tryGetMessage(_message)) {
+            _writing = true;
+            _writer.Write(*_message, &_writeTag);
+        } else if (_connection->resyncRequired()) {
+            _writing = true;
+            _finishing = true;
+            _writer.WriteAndFinish(_connection->resyncHint(), ::grpc::WriteOptions(), ElgatoServerImpl::resyncStatus(), &_writeTag);
+        } else {
+            _parked = true;
+        }
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_parked || _done) return;
+
+        _parked = false;
+        _alarmPending = true;
+        _alarm.Set(_queue, gpr_now(GPR_CLOCK_MONOTONIC), &_alarmTag);
+    }
+
+    ElgatoAsyncServer::Service* _service;
+    ServerCompletionQueue* _queue;
+    ElgatoServerImpl* _impl;
+
+    ServerContext _context;
+    ObserveRequest _request;
+    ::grpc::ServerAsyncWriter<FixtureUpdate> _writer;
+    ::grpc::Alarm _alarm;
+
+    std::mutex _mutex;
+    std::shared_ptr<ElgatoServerImpl::ClientConnection> _connection;
+    std::shared_ptr<const FixtureUpdate> _message;
+    bool _writing = false;
+    bool _parked = false;
+    bool _alarmPending = false;
+    bool _broken = false;
+    bool _finishing = false;
+    bool _done = false;
+
+    ElgatoAsyncServer::AsyncTag _requestTag = { this };
+    ElgatoAsyncServer::AsyncTag _writeTag = { this };
+    ElgatoAsyncServer::AsyncTag _alarmTag = { this };
+    ElgatoAsyncServer::AsyncTag _doneTag = { this };
+};
+
+}
+
+ElgatoAsyncServer::~ElgatoAsyncServer() {
+    if (_server) _server->Shutdown();
+    // Calls still running on a worker finish on the queues, so those go last
+    _workers.reset();
+
+    for(auto& queue : _queues) {
+        queue->Shutdown();
+    }
+
+    for(auto& thread : _threads) {
+        thread.join();
+    }
+}
+
+void ElgatoAsyncServer::run(const std::string& address, size_t completionQueues, size_t pollingThreads, size_t workerThreads) {
+    if (completionQueues == 0) completionQueues = 1;
+    if (pollingThreads == 0) pollingThreads = 1;
+    if (workerThreads == 0) workerThreads = 1;
+
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+    builder.RegisterService(&_service);
+
+    for(size_t i = 0; i < completionQueues; i++) {
+        _queues.push_back(builder.AddCompletionQueue());
+    }
+
+    _server = builder.BuildAndStart();
+    if (!_server) {
+        std::clog << kLogErr << "Failed to start RPC Server on " << address << std::endl;
+        return;
+    }
+
+    std::clog << kLogInfo << "RPC Server listening on " << address << " (" << completionQueues << " queue(s), "
+              << pollingThreads << " thread(s) each, " << workerThreads << " worker(s))" << std::endl;
+
+    _workers = std::make_unique<WorkerPool>(workerThreads);
+
+    for(auto& queue : _queues) {
+        seed(queue.get());
+
+        for(size_t i = 0; i < pollingThreads; i++) {
+            _threads.emplace_back(poll, queue.get());
+        }
+    }
+}
+
+void ElgatoAsyncServer::seed(ServerCompletionQueue* queue) {
+    auto service = &_service;
+    auto impl = &_impl;
+    auto workers = _workers.get();
+
+    new UnaryCall<grpc::ByteBuffer, grpc::ByteBuffer>(service, queue, impl, &ElgatoAsyncServer::Service::RequestListFixtures, &ElgatoServerImpl::ListFixturesSerialized);
+    new UnaryCall<FixturesSinceRequest, FixtureDelta>(service, queue, impl, &Elgato::AsyncService::RequestListFixturesSince, &ElgatoServerImpl::ListFixturesSince);
+    new UnaryCall<Empty, SimpleCliResponse>(service, queue, impl, &Elgato::AsyncService::RequestRefresh, &ElgatoServerImpl::Refresh, workers);
+    new UnaryCall<SimpleCliRequest, SimpleCliResponse>(service, queue, impl, &Elgato::AsyncService::RequestPowerOn, &ElgatoServerImpl::PowerOn, workers);
+    new UnaryCall<SimpleCliRequest, SimpleCliResponse>(service, queue, impl, &Elgato::AsyncService::RequestPowerOff, &ElgatoServerImpl::PowerOff, workers);
+    new UnaryCall<Int32CliRequest, SimpleCliResponse>(service, queue, impl, &Elgato::AsyncService::RequestSetBrightness, &ElgatoServerImpl::SetBrightness, workers);
+    new UnaryCall<Int32CliRequest, SimpleCliResponse>(service, queue, impl, &Elgato::AsyncService::RequestSetTemperature, &ElgatoServerImpl::SetTemperature, workers);
+    new UnaryCall<BatchRequest, BatchResponse>(service, queue, impl, &Elgato::AsyncService::RequestApplyBatch, &ElgatoServerImpl::ApplyBatch, workers);
+    new UnaryCall<Empty, DaemonStats>(service, queue, impl, &Elgato::AsyncService::RequestGetStats, &ElgatoServerImpl::GetStats);
+    new UnaryCall<ListFixturesRequest, FixturePage>(service, queue, impl, &Elgato::AsyncService::RequestListFixturesPaged, &ElgatoServerImpl::ListFixturesPaged);
+
+    new StreamControlCall(service, queue, impl);
+    new StreamFixturesCall(service, queue, impl);
+    new ObserveChangesCall(service, queue, impl);
+}
+
+void ElgatoAsyncServer::poll(ServerCompletionQueue* queue) {
+    void* tag;
+    bool ok;
+
+    while(queue->Next(&tag, &ok)) {
+        auto asyncTag = static_cast<AsyncTag*>(tag);
+        asyncTag->call->proceed(ok, asyncTag);
+    }
+}
\ No newline at end of file
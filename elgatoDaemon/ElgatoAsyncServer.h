@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <grpcpp/server.h>
+#include <grpcpp/server_builder.h>
+
+#include "elgato.grpc.pb.h"
+#include "WorkerPool.h"
+
+class ElgatoServerImpl;
+
+// Serves the same calls as ElgatoServerImpl from a fixed set of completion queue threads.
+// Unary calls are handed to ElgatoServerImpl, the ones that wait for lights on a worker thread so they never hold up the
+// completion queues. Idle ObserveChanges streams hold no thread at all.
+class ElgatoAsyncServer final {
+public:
+    // ListFixtures is answered with pre-serialized bytes
+    using Service = Elgato::WithRawMethod_ListFixtures<Elgato::AsyncService>;
+
+    explicit ElgatoAsyncServer(ElgatoServerImpl& impl) : _impl(impl) { }
+    ~ElgatoAsyncServer();
+
+    ElgatoAsyncServer(const ElgatoAsyncServer&) = delete;
+    ElgatoAsyncServer& operator=(const ElgatoAsyncServer&) = delete;
+
+    void run(const std::string& address, size_t completionQueues, size_t pollingThreads, size_t workerThreads);
+
+    class AsyncCall;
+    struct AsyncTag {
+        AsyncCall* call;
+    };
+
+    class AsyncCall {
+    public:
+        virtual ~AsyncCall() = default;
+        virtual void proceed(bool ok, AsyncTag* tag) = 0;
+    };
+
+private:
+    void seed(grpc::ServerCompletionQueue*);
+    static void poll(grpc::ServerCompletionQueue*);
+
+    ElgatoServerImpl& _impl;
+    Service _service;
+    std::unique_ptr<grpc::Server> _server;
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> _queues;
+    std::vector<std::thread> _threads;
+    // Runs the calls that wait for lights
+    std::unique_ptr<WorkerPool> _workers;
+};
@@ -25,41 +25,176 @@
  */
 
 #include "ElgatoLight.h"
+#include "DaemonConfig.h"
 #include "HTTPRequest.hpp"
 #include "Log.h"
 #include "../Config.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cerrno>
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include <fmt/core.h>
 #include <future>
+#include <poll.h>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
 
 using json = nlohmann::json;
 
-ElgatoLight::ElgatoLight(std::string name, char* address, uint16_t port) : _name(std::move(name)), _port(port) {
-    inet_pton(AF_INET, address, &_address.s_addr);
+std::atomic<uint64_t> ElgatoLight::_stateGeneration = 0;
+
+ElgatoLight::ElgatoLight(std::string name, const char* address, uint16_t port, int interfaceIndex) : _name(std::move(name)) {
+    ElgatoLightPath path;
+    inet_pton(AF_INET, address, &path.address.s_addr);
+    path.port = port;
+    path.interfaceIndex = interfaceIndex;
+    _paths.push_back(path);
+
+    auto& config = DaemonConfig::getInstance();
+    if (config.lightWriteRate > 0)
+        _writeBucket = std::make_unique<TokenBucket>(config.lightWriteRate, config.lightWriteBurst);
 
     queryAccessory();
+    if (cachedDeviceInfo() != nullptr) queryState();
+}
+
+ElgatoLight::ElgatoLight(std::string name, const char* address, uint16_t port, std::shared_ptr<ElgatoAccessoryInfo> accessoryInfo,
+                         bool accessoryComplete, int interfaceIndex)
+    : _name(std::move(name)), _accessoryInfo(std::move(accessoryInfo)), _accessoryComplete(accessoryComplete) {
+    ElgatoLightPath path;
+    inet_pton(AF_INET, address, &path.address.s_addr);
+    path.port = port;
+    path.interfaceIndex = interfaceIndex;
+    _paths.push_back(path);
+
+    auto& config = DaemonConfig::getInstance();
+    if (config.lightWriteRate > 0)
+        _writeBucket = std::make_unique<TokenBucket>(config.lightWriteRate, config.lightWriteBurst);
+
     if (_accessoryInfo != nullptr) queryState();
 }
 
+ElgatoLight::~ElgatoLight() {
+    std::unique_lock<std::mutex> lock(_writeMutex);
+    _stopping = true;
+    lock.unlock();
+    _drainCond.notify_all();
+
+    if (_drainThread.joinable()) _drainThread.join();
+    // Waits for a hedge loser still on the wire, its attempt timeout is short
+    _hedgeAttempts.reset();
+}
+
 std::string ElgatoLight::portString() const {
     char address[20];
+    auto known = paths();
+    auto path = known.empty() ? ElgatoLightPath() : known.front();
+
+    inet_ntop(AF_INET, &path.address.s_addr, address, sizeof(address));
+    return std::string(address) + ":" + std::to_string(path.port);
+}
+
+void ElgatoLight::addPath(const char* address, uint16_t port, int interfaceIndex) {
+    ElgatoLightPath newPath;
+    inet_pton(AF_INET, address, &newPath.address.s_addr);
+    newPath.port = port;
+    newPath.interfaceIndex = interfaceIndex;
+
+    auto known = paths();
+    for(auto& path : known) {
+        if (path.interfaceIndex == interfaceIndex) {
+            path = newPath;
+        }
+    }
+
+    if (std::none_of(known.begin(), known.end(), [interfaceIndex](const auto& path) { return path.interfaceIndex == interfaceIndex; }))
+        known.push_back(newPath);
+
+    // Measure outside the lock, this is a handshake per path and only happens when the set of paths changes
+    if (known.size() > 1) {
+        for(auto& path : known) {
+            if (path.rtt == std::chrono::microseconds::zero())
+                path.rtt = measureRtt(path.address, path.port, connectTimeout().count());
+        }
+
+        std::stable_sort(known.begin(), known.end(), [](const auto& a, const auto& b) { return a.rtt < b.rtt; });
+    }
 
-    inet_ntop(AF_INET, &_address.s_addr, address, sizeof(address));
-    return std::string(address) + ":" + std::to_string(port());
+    std::lock_guard<std::mutex> lock(_addressMutex);
+    _paths = known;
+}
+
+size_t ElgatoLight::removePath(int interfaceIndex) {
+    std::lock_guard<std::mutex> lock(_addressMutex);
+    _paths.erase(std::remove_if(_paths.begin(), _paths.end(), [interfaceIndex](const auto& path) {
+        return path.interfaceIndex == interfaceIndex;
+    }), _paths.end());
+
+    return _paths.size();
+}
+
+uint32_t ElgatoLight::markLost() {
+    _lost = true;
+    _stateGeneration++;
+    auto lossCount = ++_lossCount;
+
+    notifyChanged();
+    return lossCount;
+}
+
+void ElgatoLight::revive(const char* address, uint16_t port, int interfaceIndex) {
+    ElgatoLightPath path;
+    inet_pton(AF_INET, address, &path.address.s_addr);
+    path.port = port;
+    path.interfaceIndex = interfaceIndex;
+
+    // Old paths are stale after roaming
+    std::unique_lock<std::mutex> lock(_addressMutex);
+    _paths = { path };
+    lock.unlock();
+
+    _lost = false;
+    _stateGeneration++;
+    notifyChanged();
+}
+
+void ElgatoLight::notifyChanged() {
+    std::unique_lock<std::mutex> lock(_listenerMutex);
+    auto listener = _changeListener;
+    lock.unlock();
+
+    if (listener) listener();
+}
+
+std::shared_ptr<ElgatoAccessoryInfo> ElgatoLight::deviceInfo() {
+    std::unique_lock<std::mutex> lock(_accessoryMutex);
+    if (_accessoryComplete) return _accessoryInfo;
+    lock.unlock();
+
+    queryAccessory();
+    return cachedDeviceInfo();
 }
 
 void ElgatoLight::queryAccessory() {
     try {
         auto requestString = "http://" + portString() + "/elgato/accessory-info";
 
-        http::Request request{requestString};
-        const auto response = request.send("GET");
-        const auto resString = std::string{response.body.begin(), response.body.end()};
+        auto slot = _scheduler.acquire(LightTraffic::Poll);
+        const auto resString = get(requestString);
 
-        _accessoryInfo = std::make_shared<ElgatoAccessoryInfo>( json::parse(resString).get<ElgatoAccessoryInfo>() );
+        auto info = std::make_shared<ElgatoAccessoryInfo>( json::parse(resString).get<ElgatoAccessoryInfo>() );
+
+        std::unique_lock<std::mutex> lock(_accessoryMutex);
+        if (_accessoryInfo != nullptr) info->deviceId = _accessoryInfo->deviceId;
+        _accessoryInfo = info;
+        _accessoryComplete = true;
+        _stateGeneration++;
+        lock.unlock();
+
+        notifyChanged();
     } catch (const std::exception& e) {
         std::clog << kLogWarning << "Request failed, error: " << e.what() << std::endl;
     }
@@ -69,55 +204,221 @@ void ElgatoLight::queryState() {
     try {
         auto requestString = "http://" + portString() + "/elgato/lights";
 
-        http::Request request{requestString};
-        const auto response = request.send("GET");
-        const auto resString = std::string{response.body.begin(), response.body.end()};
+        auto slot = _scheduler.acquire(LightTraffic::Poll);
+        const auto resString = get(requestString);
+
+        std::atomic_store(&_stateInfo, std::make_shared<ElgatoStateInfo>( json::parse(resString).get<ElgatoStateInfo>() ));
+        _stateGeneration++;
+        _stateUpdatedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 
-        _stateInfo = std::make_shared<ElgatoStateInfo>( json::parse(resString).get<ElgatoStateInfo>() );
+        notifyChanged();
     } catch(const std::exception& e) {
         std::clog << kLogWarning << "Request failed, error: " << e.what() << std::endl;
     }
 }
 
-bool ElgatoLight::powerOn() {
-    const std::string body = R"({"lights": [{"on": 1}]})";
-    return sendRequest(body);
+WriteResult ElgatoLight::powerOn(LightTraffic traffic, bool force) {
+    return write(LightProperty::Power, 1, traffic, force);
 }
 
-bool ElgatoLight::powerOff() {
-    const std::string body = R"({"lights": [{"on": 0}]})";
-    return sendRequest(body);
+WriteResult ElgatoLight::powerOff(LightTraffic traffic, bool force) {
+    return write(LightProperty::Power, 0, traffic, force);
 }
 
-bool ElgatoLight::setBrightness(uint8_t level) {
-    if (level > 100) level = 100;
+WriteResult ElgatoLight::setBrightness(uint8_t level, LightTraffic traffic, bool force) {
+    return write(LightProperty::Brightness, level, traffic, force);
+}
 
-    const std::string body = fmt::format(R"({{"lights": [{{"brightness": {}}}]}})", level);
-    return sendRequest(body);
+WriteResult ElgatoLight::setTemperature(uint16_t temperature, LightTraffic traffic, bool force) {
+    return write(LightProperty::Temperature, temperature, traffic, force);
 }
 
-bool ElgatoLight::setTemperature(uint16_t temperature) {
-    if (temperature <= 2900) temperature = 2900;
-    if (temperature >= 7000) temperature = 7000;
+WriteResult ElgatoLight::write(LightProperty property, uint32_t value, LightTraffic traffic, bool force) {
+    WriteResult result;
 
-    const std::string body = fmt::format(R"({{"lights": [{{"temperature": {}}}]}})", colorToElgato(temperature));
-    return sendRequest(body);
+    auto batch = mergeWrite(property, value, traffic, force);
+    if (batch == nullptr) {
+        result.successful = true;
+        result.elided = true;
+        result.applied[property] = normalizedValue(property, value);
+        return result;
+    }
+
+    std::unique_lock<std::mutex> lock(_writeMutex);
+    _writeCond.wait(lock, [&batch] { return batch->done; });
+
+    result.successful = batch->successful;
+    if (result.successful) result.applied = batch->writes;
+    return result;
 }
 
-bool ElgatoLight::sendRequest(const std::string& requestBody) {
-    try {
-        auto requestString = "http://" + portString() + "/elgato/lights";
-        http::Request request{requestString};
-        const auto response = request.send("PUT", requestBody, {{"Content-Type", "application/json"}});
-#if DEBUG_BUILD
-        std::clog << kLogDebug << "(ElgatoLight) " << requestBody << " to " << requestString << " -> " << std::to_string(response.status.code) << std::endl;
-#endif
+void ElgatoLight::queueWrite(LightProperty property, uint32_t value, const std::string& origin,
+                             std::function<void(const std::map<LightProperty, uint32_t>&)> onApplied, bool force) {
+    mergeWrite(property, value, LightTraffic::Interactive, force, origin, std::move(onApplied));
+}
 
-        if (response.status.code != 200)
-            return false;
+std::shared_ptr<ElgatoLight::WriteBatch> ElgatoLight::mergeWrite(LightProperty property, uint32_t value, LightTraffic traffic, bool force,
+                                                                 const std::string& origin,
+                                                                 std::function<void(const std::map<LightProperty, uint32_t>&)> onApplied) {
+    std::unique_lock<std::mutex> lock(_writeMutex);
+
+    // While writes are pending or on the wire the state is about to change, so it can't be trusted
+    if (!force && !_draining && isCurrent(property, value)) {
+        _writesElided++;
+        return nullptr;
+    }
+    if (_pendingBatch == nullptr) _pendingBatch = std::make_shared<WriteBatch>();
+
+    auto batch = _pendingBatch;
+    batch->writes[property] = normalizedValue(property, value);
+    // The batch goes out with the most urgent class of its writes
+    batch->traffic = std::min(batch->traffic, traffic);
+    if (onApplied) {
+        auto& writer = batch->writers[origin];
+        writer.properties.insert(property);
+        writer.onApplied = std::move(onApplied);
+    }
+
+    _draining = true;
+    if (!_drainThread.joinable()) _drainThread = std::thread(&ElgatoLight::drainWrites, this);
+    lock.unlock();
+
+    _drainCond.notify_one();
+    return batch;
+}
+
+void ElgatoLight::drainWrites() {
+    std::unique_lock<std::mutex> lock(_writeMutex);
+
+    while(true) {
+        _drainCond.wait(lock, [this] { return _stopping || _pendingBatch != nullptr; });
+        if (_stopping) break;
+
+        // Writes arriving while the light has no token left are merged into the pending batch
+        if (_writeBucket) {
+            lock.unlock();
+            std::chrono::microseconds wait;
+            while(!_writeBucket->tryTake(wait)) {
+                std::this_thread::sleep_for(wait);
+            }
+            lock.lock();
+            if (_stopping) break;
+        }
+
+        auto batch = std::move(_pendingBatch);
+        _pendingBatch = nullptr;
+        auto writes = batch->writes;
+        auto writers = batch->writers;
+        lock.unlock();
+
+        json state = json::object();
+        for(auto& [property, value] : writes) {
+            switch(property) {
+                case LightProperty::Power:
+                    state["on"] = deviceValue(property, value);
+                    break;
+                case LightProperty::Brightness:
+                    state["brightness"] = deviceValue(property, value);
+                    break;
+                case LightProperty::Temperature:
+                    state["temperature"] = deviceValue(property, value);
+                    break;
+            }
+        }
+
+        auto successful = sendRequest(json{{"lights", json::array({state})}}.dump(), batch->traffic, batch->created);
+        // Each origin hears about its own properties only, so every change is published under the client that made it
+        for(auto& [origin, writer] : writers) {
+            std::map<LightProperty, uint32_t> applied;
+            for(auto property : writer.properties) {
+                applied[property] = writes.at(property);
+            }
+
+            if (successful) writer.onApplied(applied);
+        }
+
+        lock.lock();
+        batch->successful = successful;
+        batch->done = true;
+        if (_pendingBatch == nullptr) _draining = false;
+        _writeCond.notify_all();
+    }
+
+    if (_pendingBatch != nullptr) {
+        _pendingBatch->done = true;
+        _pendingBatch = nullptr;
+    }
+
+    _draining = false;
+    _writeCond.notify_all();
+}
+
+bool ElgatoLight::isCurrent(LightProperty property, uint32_t value) const {
+    auto maxAgeMs = DaemonConfig::getInstance().writeElisionMaxAgeMs;
+    auto state = deviceState();
+    if (maxAgeMs == 0 || state == nullptr) return false;
+
+    auto nowUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (nowUs - _stateUpdatedUs > static_cast<int64_t>(maxAgeMs) * 1000) return false;
 
-        const auto resString = std::string{response.body.begin(), response.body.end()};
-        _stateInfo = std::make_shared<ElgatoStateInfo>(json::parse(resString).get<ElgatoStateInfo>() );
+    switch(property) {
+        case LightProperty::Power:
+            return state->on == deviceValue(property, value);
+        case LightProperty::Brightness:
+            return state->brightness == deviceValue(property, value);
+        case LightProperty::Temperature:
+            return state->temperature == static_cast<uint8_t>(deviceValue(property, value));
+    }
+
+    return false;
+}
+
+uint32_t ElgatoLight::normalizedValue(LightProperty property, uint32_t value) {
+    switch(property) {
+        case LightProperty::Power:
+            return value > 0 ? 1 : 0;
+        case LightProperty::Brightness:
+            return std::min<uint32_t>(value, 100);
+        case LightProperty::Temperature:
+            return std::clamp<uint32_t>(value, 2900, 7000);
+    }
+
+    return value;
+}
+
+uint32_t ElgatoLight::deviceValue(LightProperty property, uint32_t value) {
+    value = normalizedValue(property, value);
+    return property == LightProperty::Temperature ? colorToElgato(value) : value;
+}
+
+// Only called by the drain thread of the light, so writes never overlap
+bool ElgatoLight::sendRequest(const std::string& requestBody, LightTraffic traffic, std::chrono::steady_clock::time_point enqueued) {
+    auto requestString = "http://" + portString() + "/elgato/lights";
+
+    // The loser of the last hedged write must not land after this one. It is waited for before taking the slot, so
+    // only this light's writes wait, and only for the attempt timeout of the race.
+    if (_lastRace) {
+        std::unique_lock<std::mutex> raceLock(_lastRace->mutex);
+        _lastRace->cond.wait(raceLock, [race = _lastRace.get()] { return race->finished == race->launched; });
+        raceLock.unlock();
+        _lastRace = nullptr;
+    }
+
+    auto slot = _scheduler.acquire(traffic, enqueued);
+
+    auto start = std::chrono::steady_clock::now();
+    auto hedgeAfter = hedgeDelay();
+    auto response = hedgeAfter ? putHedged(requestString, requestBody, *hedgeAfter)
+                               : put(requestString, requestBody, requestTimeout());
+    if (!response) return false;
+
+    recordWriteLatency(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+
+    try {
+        const auto& resString = *response;
+        std::atomic_store(&_stateInfo, std::make_shared<ElgatoStateInfo>(json::parse(resString).get<ElgatoStateInfo>() ));
+        _stateGeneration++;
+        _stateUpdatedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 
 #if DEBUG_BUILD
         std::clog << kLogDebug << "(ElgatoLight) response: " << resString << std::endl;
@@ -125,11 +426,161 @@ bool ElgatoLight::sendRequest(const std::string& requestBody) {
 
         return true;
     } catch (const std::exception& e) {
-        std::clog << kLogWarning << "Request " << requestBody << " failed, error: " << e.what() << std::endl;
+        std::clog << kLogWarning << "Invalid response to " << requestBody << ", error: " << e.what() << std::endl;
         return false;
     }
 }
 
+std::string ElgatoLight::get(const std::string& uri) {
+    http::Request request{uri};
+    auto timeout = requestTimeout();
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        const auto response = request.send("GET", "", {}, timeout);
+        _rttEstimator.sample(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+
+        return std::string{response.body.begin(), response.body.end()};
+    } catch (const std::exception&) {
+        if (std::chrono::steady_clock::now() - start >= timeout) _rttEstimator.backoff();
+        throw;
+    }
+}
+
+std::optional<std::string> ElgatoLight::put(const std::string& uri, const std::string& body, std::chrono::milliseconds timeout, bool backOff) {
+    auto start = std::chrono::steady_clock::now();
+
+    try {
+        http::Request request{uri};
+        const auto response = request.send("PUT", body, {{"Content-Type", "application/json"}}, timeout);
+        _rttEstimator.sample(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+#if DEBUG_BUILD
+        std::clog << kLogDebug << "(ElgatoLight) " << body << " to " << uri << " -> " << std::to_string(response.status.code) << std::endl;
+#endif
+
+        if (response.status.code != 200)
+            return std::nullopt;
+
+        return std::string{response.body.begin(), response.body.end()};
+    } catch (const std::exception& e) {
+        // A timeout leaves no sample, without backing off the next request would get the same too short timeout
+        if (backOff && std::chrono::steady_clock::now() - start >= timeout) _rttEstimator.backoff();
+
+        std::clog << kLogWarning << "Request " << body << " failed, error: " << e.what() << std::endl;
+        return std::nullopt;
+    }
+}
+
+// Writes are absolute values, so sending the same one twice is safe. The HTTP client can't abort a request, the loser
+// is abandoned instead and runs into its attempt timeout at the latest. Attempts only get a few times the hedge delay,
+// so the next write doesn't wait long for a loser. A write slower than that on both attempts is sent once more with
+// the full timeout.
+std::optional<std::string> ElgatoLight::putHedged(const std::string& uri, const std::string& body, std::chrono::microseconds hedgeAfter) {
+    auto race = std::make_shared<HedgeRace>();
+    auto timeout = std::min(requestTimeout(), std::chrono::ceil<std::chrono::milliseconds>(hedgeAfter * kHedgeAttemptFactor));
+
+    // Both attempts can be on the wire at once, the pool lives as long as the light
+    if (!_hedgeAttempts) _hedgeAttempts = std::make_unique<WorkerPool>(2);
+
+    // A short attempt timing out says nothing about the light's round trip time, so it doesn't back off
+    auto attempt = [this, race, uri, body, timeout](int index) {
+        auto response = put(uri, body, timeout, false);
+
+        std::lock_guard<std::mutex> lock(race->mutex);
+        race->finished++;
+        if (response && race->winner < 0) {
+            race->winner = index;
+            race->response = std::move(response);
+        }
+        race->cond.notify_all();
+    };
+
+    std::unique_lock<std::mutex> lock(race->mutex);
+    _hedgeAttempts->submit([attempt] { attempt(0); });
+
+    if (!race->cond.wait_for(lock, hedgeAfter, [&race] { return race->finished > 0; })) {
+        race->launched++;
+        _hedgesIssued++;
+        _hedgeAttempts->submit([attempt] { attempt(1); });
+    }
+
+    race->cond.wait(lock, [&race] { return race->winner >= 0 || race->finished == race->launched; });
+    if (race->winner == 1) _hedgesWon++;
+
+    auto response = race->response;
+    lock.unlock();
+
+    // Without a winner every attempt has finished, so nothing is left to land after the retry
+    if (!response) return put(uri, body, requestTimeout());
+
+    _lastRace = race;
+    return response;
+}
+
+std::chrono::milliseconds ElgatoLight::requestTimeout() const {
+    const auto& config = DaemonConfig::getInstance();
+    return _rttEstimator.timeout(std::chrono::milliseconds(config.requestTimeoutFloorMs), std::chrono::milliseconds(config.requestTimeoutCeilingMs));
+}
+
+std::chrono::milliseconds ElgatoLight::connectTimeout() const {
+    const auto& config = DaemonConfig::getInstance();
+    return _rttEstimator.timeout(std::chrono::milliseconds(config.connectTimeoutFloorMs), std::chrono::milliseconds(config.connectTimeoutCeilingMs));
+}
+
+std::optional<std::chrono::microseconds> ElgatoLight::hedgeDelay() const {
+    const auto& config = DaemonConfig::getInstance();
+    if (!config.hedgeWrites) return std::nullopt;
+
+    std::unique_lock<std::mutex> lock(_latencyMutex);
+    if (_writeLatencies.size() < kLatencyMinSamples) return std::nullopt;
+
+    auto latencies = _writeLatencies;
+    lock.unlock();
+
+    auto p95 = latencies.begin() + static_cast<std::ptrdiff_t>(latencies.size() * 95 / 100);
+    std::nth_element(latencies.begin(), p95, latencies.end());
+
+    return std::max<std::chrono::microseconds>(*p95, std::chrono::milliseconds(config.hedgeMinDelayMs));
+}
+
+void ElgatoLight::recordWriteLatency(std::chrono::microseconds latency) {
+    std::lock_guard<std::mutex> lock(_latencyMutex);
+
+    if (_writeLatencies.size() < kLatencyWindow) {
+        _writeLatencies.push_back(latency);
+        return;
+    }
+
+    _writeLatencies[_nextLatency] = latency;
+    _nextLatency = (_nextLatency + 1) % kLatencyWindow;
+}
+
+std::chrono::microseconds ElgatoLight::measureRtt(const in_addr& address, uint16_t port, uint32_t timeoutMs) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) return std::chrono::microseconds::max();
+
+    sockaddr_in target = {};
+    target.sin_family = AF_INET;
+    target.sin_port = htons(port);
+    target.sin_addr = address;
+
+    auto startTime = std::chrono::steady_clock::now();
+    auto result = std::chrono::microseconds::max();
+
+    if (connect(sock, (sockaddr*)&target, sizeof(target)) == 0 || errno == EINPROGRESS) {
+        pollfd pollFd = { sock, POLLOUT, 0 };
+        int error = 0;
+        socklen_t length = sizeof(error);
+
+        if (poll(&pollFd, 1, (int)timeoutMs) == 1 &&
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0)
+            result = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+    }
+
+    close(sock);
+    return result;
+}
+
 uint16_t ElgatoLight::colorFromElgato(int elgatoValue) {
     auto converted = 1000000 * pow(elgatoValue, -1);
     return (uint16_t)std::round(converted);
@@ -27,10 +27,26 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <netinet/in.h>
+#include <optional>
+#include <set>
 #include <nlohmann/json.hpp>
 #include <iostream>
+#include <thread>
+#include <vector>
+
+#include "RequestScheduler.h"
+#include "RttEstimator.h"
+#include "TokenBucket.h"
+#include "WorkerPool.h"
 
 class ElgatoStateChangedEventArgs;
 
@@ -44,6 +60,9 @@ public:
     std::string firmwareVersion = {};
     std::string serialNumber = {};
     std::string displayName = {};
+
+    // Hardware id (MAC) from the mDNS TXT record, not part of accessory-info
+    std::string deviceId = {};
 };
 
 class ElgatoStateInfo final {
@@ -55,50 +74,251 @@ public:
     uint8_t temperature = 0;
 };
 
-class ElgatoLight final {
+// One way to reach a light, there is one per network interface the light was resolved on
+struct ElgatoLightPath {
+    in_addr address = {};
+    uint16_t port = 0;
+    int interfaceIndex = -1;
+    std::chrono::microseconds rtt = std::chrono::microseconds::zero();
+};
+
+enum class LightProperty { Power, Brightness, Temperature };
+
+// What became of one write to a light
+struct WriteResult {
+    bool successful = false;
+    // Nothing was sent, the light already showed the value
+    bool elided = false;
+    // Every value the request carrying the write set. Writes merged into the same request may have replaced the
+    // caller's own value, so this is what the light shows now
+    std::map<LightProperty, uint32_t> applied = {};
+};
+
+class ElgatoLight final : public std::enable_shared_from_this<ElgatoLight> {
 public:
-    ElgatoLight(std::string name, char* address, uint16_t port);
+    ElgatoLight(std::string name, const char* address, uint16_t port, int interfaceIndex = -1);
+    // accessoryComplete is false when the info only holds what the mDNS TXT record carries
+    ElgatoLight(std::string name, const char* address, uint16_t port, std::shared_ptr<ElgatoAccessoryInfo> accessoryInfo,
+                bool accessoryComplete = true, int interfaceIndex = -1);
+    // Writes still waiting for the light fail
+    ~ElgatoLight();
+
+    ElgatoLight(const ElgatoLight&) = delete;
+    ElgatoLight& operator=(const ElgatoLight&) = delete;
 
     [[nodiscard]] std::string name() const { return _name; }
-    [[nodiscard]] in_addr address() const { return _address; }
-    [[nodiscard]] uint16_t port() const { return _port; }
+    // Assigned by the AvahiBrowser when the light is registered, 0 until then
+    [[nodiscard]] uint32_t handle() const { return _handle; }
+    void setHandle(uint32_t handle) { _handle = handle; }
+    // The path with the lowest measured round trip time
+    [[nodiscard]] in_addr address() const {
+        std::lock_guard<std::mutex> lock(_addressMutex);
+        return _paths.empty() ? in_addr{} : _paths.front().address;
+    }
+
+    [[nodiscard]] uint16_t port() const {
+        std::lock_guard<std::mutex> lock(_addressMutex);
+        return _paths.empty() ? 0 : _paths.front().port;
+    }
+
+    [[nodiscard]] std::vector<ElgatoLightPath> paths() const {
+        std::lock_guard<std::mutex> lock(_addressMutex);
+        return _paths;
+    }
+
+    void addPath(const char* address, uint16_t port, int interfaceIndex);
+    // Returns the number of paths left
+    size_t removePath(int interfaceIndex);
 
     [[nodiscard]] bool isReady() const {
-        return _accessoryInfo != nullptr && _stateInfo != nullptr;
+        return !_lost && cachedDeviceInfo() != nullptr && deviceState() != nullptr;
     }
 
-    [[nodiscard]] std::shared_ptr<ElgatoAccessoryInfo> deviceInfo() const {
+    // A lost light has left mDNS but is kept around for a grace period in case it comes back
+    [[nodiscard]] bool isLost() const { return _lost; }
+    [[nodiscard]] uint32_t lossCount() const { return _lossCount; }
+
+    uint32_t markLost();
+    void revive(const char* address, uint16_t port, int interfaceIndex);
+
+    // Called whenever the info, state or reachability changed other than through a write, which the writer publishes
+    void setChangeListener(std::function<void()> listener) {
+        std::lock_guard<std::mutex> lock(_listenerMutex);
+        _changeListener = std::move(listener);
+    }
+
+    // Fetches the fields missing from the TXT record on first use
+    std::shared_ptr<ElgatoAccessoryInfo> deviceInfo();
+
+    // Never touches the network
+    [[nodiscard]] std::shared_ptr<ElgatoAccessoryInfo> cachedDeviceInfo() const {
+        std::lock_guard<std::mutex> lock(_accessoryMutex);
         return _accessoryInfo;
     }
 
+    // False until accessory-info was fetched, so a light built from the TXT record has no display name and serial number yet
+    [[nodiscard]] bool hasCompleteInfo() const {
+        std::lock_guard<std::mutex> lock(_accessoryMutex);
+        return _accessoryComplete;
+    }
+
+    // True for the one caller that may run the deferred accessory-info fetch, which calls releaseInfoFetch when done
+    bool claimInfoFetch() {
+        return !hasCompleteInfo() && !_infoFetchClaimed.exchange(true);
+    }
+
+    // A failed fetch is retried on the next demand
+    void releaseInfoFetch() { _infoFetchClaimed = false; }
+
     [[nodiscard]] std::shared_ptr<ElgatoStateInfo> deviceState() const {
-        return _stateInfo;
+        return std::atomic_load(&_stateInfo);
     }
 
     [[nodiscard]] std::string portString() const;
 
-    bool powerOn();
-    bool powerOff();
+    // The setters block until the light answered. Writes above the light's rate are merged into the one waiting for
+    // its turn, so the result may already carry a newer value from another caller.
+    // A write the light's recent state already shows is skipped unless force is set
+    WriteResult powerOn(LightTraffic traffic = LightTraffic::Interactive, bool force = false);
+    WriteResult powerOff(LightTraffic traffic = LightTraffic::Interactive, bool force = false);
 
-    bool setBrightness(uint8_t level);
-    bool setTemperature(uint16_t temperature);
+    WriteResult setBrightness(uint8_t level, LightTraffic traffic = LightTraffic::Interactive, bool force = false);
+    WriteResult setTemperature(uint16_t temperature, LightTraffic traffic = LightTraffic::Interactive, bool force = false);
+
+    // For continuous input: only the latest value per property is kept and sent as one combined request once the
+    // previous one has finished. Once the light accepted a request, onApplied gets the values it set for the properties
+    // origin queued; a later write from the same origin replaces its callback.
+    void queueWrite(LightProperty property, uint32_t value, const std::string& origin,
+                    std::function<void(const std::map<LightProperty, uint32_t>&)> onApplied, bool force = false);
+    // Shared by the setters: merges into the pending write and waits for it
+    WriteResult write(LightProperty property, uint32_t value, LightTraffic traffic, bool force);
+
+    [[nodiscard]] uint64_t writesElided() const { return _writesElided; }
+    [[nodiscard]] uint64_t hedgesIssued() const { return _hedgesIssued; }
+    [[nodiscard]] uint64_t hedgesWon() const { return _hedgesWon; }
+
+    // Fed by every request that got an answer
+    [[nodiscard]] const RttEstimator& rttEstimator() const { return _rttEstimator; }
+    // Derived from the round trip times, within the configured floor and ceiling
+    [[nodiscard]] std::chrono::milliseconds requestTimeout() const;
+    [[nodiscard]] std::chrono::milliseconds connectTimeout() const;
 
     static uint16_t colorToElgato(int colorValue);
     static uint16_t colorFromElgato(int elgatoValue);
 
+    // Time for a TCP handshake, std::chrono::microseconds::max() if it fails within timeoutMs
+    static std::chrono::microseconds measureRtt(const in_addr& address, uint16_t port, uint32_t timeoutMs);
+
+    // Changes whenever the info, state or reachability of any light changes
+    static uint64_t stateGeneration() { return _stateGeneration; }
 
 private:
-    bool sendRequest(const std::string& requestBody);
+    // One origin's queued writes in a batch
+    struct QueuedWriter {
+        std::set<LightProperty> properties;
+        std::function<void(const std::map<LightProperty, uint32_t>&)> onApplied;
+    };
+
+    // Writes merged while waiting for the light, latest value per property wins
+    struct WriteBatch {
+        std::map<LightProperty, uint32_t> writes;
+        std::map<std::string, QueuedWriter> writers;
+        LightTraffic traffic = LightTraffic::Poll;
+        // When the first write was merged, the wait for a token counts as queueing
+        std::chrono::steady_clock::time_point created = std::chrono::steady_clock::now();
+        bool done = false;
+        bool successful = false;
+    };
+
+    // The attempts of one hedged write, the loser keeps running until it finishes or times out
+    struct HedgeRace {
+        std::mutex mutex;
+        std::condition_variable cond;
+        int launched = 1;
+        int finished = 0;
+        int winner = -1;
+        std::optional<std::string> response;
+    };
+
+    bool sendRequest(const std::string& requestBody, LightTraffic traffic,
+                     std::chrono::steady_clock::time_point enqueued = std::chrono::steady_clock::now());
+    // Throws if the light doesn't answer within requestTimeout()
+    std::string get(const std::string& uri);
+    // The response body on 200, nothing otherwise
+    // backOff raises the next timeout if this one ran out, only requests with the full timeout should
+    std::optional<std::string> put(const std::string& uri, const std::string& body, std::chrono::milliseconds timeout, bool backOff = true);
+    std::optional<std::string> putHedged(const std::string& uri, const std::string& body, std::chrono::microseconds hedgeAfter);
+    // The light's p95 write latency, nothing while hedging is off or there are too few samples
+    std::optional<std::chrono::microseconds> hedgeDelay() const;
+    void recordWriteLatency(std::chrono::microseconds latency);
+    // nullptr if the write was elided
+    std::shared_ptr<WriteBatch> mergeWrite(LightProperty property, uint32_t value, LightTraffic traffic, bool force,
+                                           const std::string& origin = {},
+                                           std::function<void(const std::map<LightProperty, uint32_t>&)> onApplied = nullptr);
+    // Whether the known state already shows value and is recent enough to trust
+    bool isCurrent(LightProperty property, uint32_t value) const;
+    // The value within the range the light supports
+    static uint32_t normalizedValue(LightProperty property, uint32_t value);
+    // The value as the light's API expects it
+    static uint32_t deviceValue(LightProperty property, uint32_t value);
+    void drainWrites();
 
     void queryAccessory();
     void queryState();
+    void notifyChanged();
 
     std::string _name = {};
-    in_addr _address = {};
-    uint16_t _port = 0;
+    std::atomic<uint32_t> _handle = 0;
+
+    // Every HTTP request to the light goes through it
+    RequestScheduler _scheduler;
+    RttEstimator _rttEstimator;
+
+    mutable std::mutex _addressMutex;
+    std::vector<ElgatoLightPath> _paths = {};
+
+    std::mutex _listenerMutex;
+    std::function<void()> _changeListener = nullptr;
 
+    std::atomic<bool> _lost = false;
+    std::atomic<uint32_t> _lossCount = 0;
+
+    mutable std::mutex _accessoryMutex;
     std::shared_ptr<ElgatoAccessoryInfo> _accessoryInfo = nullptr;
+    bool _accessoryComplete = false;
+    std::atomic<bool> _infoFetchClaimed = false;
+    // Replaced by the drain thread while others read it, only accessed through std::atomic_load and std::atomic_store
     std::shared_ptr<ElgatoStateInfo> _stateInfo = nullptr;
+    // Steady clock, when _stateInfo was last read from the light
+    std::atomic<int64_t> _stateUpdatedUs = 0;
+    std::atomic<uint64_t> _writesElided = 0;
+
+    // Latencies of the last kLatencyWindow writes, oldest first once it is full
+    static constexpr size_t kLatencyWindow = 64;
+    // Each attempt of a hedged write gets this many times the hedge delay, within requestTimeout()
+    static constexpr int kHedgeAttemptFactor = 4;
+    static constexpr size_t kLatencyMinSamples = 16;
+    mutable std::mutex _latencyMutex;
+    std::vector<std::chrono::microseconds> _writeLatencies = {};
+    size_t _nextLatency = 0;
+    std::shared_ptr<HedgeRace> _lastRace = nullptr;
+    // Runs the attempts of hedged writes, created with the first one
+    std::unique_ptr<WorkerPool> _hedgeAttempts;
+    std::atomic<uint64_t> _hedgesIssued = 0;
+    std::atomic<uint64_t> _hedgesWon = 0;
+
+    std::mutex _writeMutex;
+    std::condition_variable _writeCond;
+    std::shared_ptr<WriteBatch> _pendingBatch = nullptr;
+    bool _draining = false;
+    // The one thread sending this light's writes, started with the first write and joined by the destructor
+    std::condition_variable _drainCond;
+    bool _stopping = false;
+    std::thread _drainThread;
+    // Limits the PUTs per second the firmware gets, nullptr if unlimited
+    std::unique_ptr<TokenBucket> _writeBucket;
+
+    static std::atomic<uint64_t> _stateGeneration;
 };
 
 void from_json(const nlohmann::json&, ElgatoAccessoryInfo&);
@@ -24,19 +24,30 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
 #include <chrono>
+#include <fmt/core.h>
+#include <future>
+#include <google/protobuf/arena.h>
+#include <google/protobuf/util/field_mask_util.h>
 #include <grpc/grpc.h>
 #include <grpcpp/security/server_credentials.h>
 #include <grpcpp/server.h>
 #include <grpcpp/server_builder.h>
 #include <grpcpp/server_context.h>
+#include <grpcpp/impl/codegen/proto_utils.h>
+#include <regex>
+#include <set>
 #include <thread>
 #include <uuid/uuid.h>
 
 #include "../Config.h"
 #include "ElgatoServerImpl.h"
+#include "ElgatoAsyncServer.h"
 #include "Log.h"
 #include "AvahiBrowser.h"
+#include "DaemonConfig.h"
+#include "SubnetScanner.h"
 
 
 using ::grpc::Status;
@@ -50,8 +61,60 @@ using ::SimpleCliResponse;
 
 using namespace std::chrono_literals;
 
+// Sequences of a restarted daemon never overlap with the ones handed out before
+static uint64_t firstSequence() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool isKnownOperation(FixtureOperation operation) {
+    return operation == POWER_ON || operation == POWER_OFF || operation == SET_BRIGHTNESS || operation == SET_TEMPERATURE;
+}
+
+// Requests address fixtures either by handle or by a name filter
+template <typename Request>
+static std::vector<std::shared_ptr<ElgatoLight>> targetsOf(const Request& request) {
+    if (request.target_case() == Request::kHandle) {
+        auto light = AvahiBrowser::getInstance().byHandle(request.handle());
+        if (light == nullptr) return {};
+
+        return { light };
+    }
+
+    return AvahiBrowser::getInstance().allByName(request.fixturefilter());
+}
+
+// targetsOf for the unary handlers, an invalid name filter is the caller's fault
+template <typename Request>
+static Status resolveTargets(const Request& request, std::vector<std::shared_ptr<ElgatoLight>>& lights) {
+    try {
+        lights = targetsOf(request);
+    } catch(const std::regex_error& e) {
+        return { grpc::StatusCode::INVALID_ARGUMENT, std::string("Invalid filter: ") + e.what() };
+    }
+
+    return Status::OK;
+}
+
+ElgatoServerImpl::ElgatoServerImpl()
+    : _updates(DaemonConfig::getInstance().updateBacklog, firstSequence()), _registryVersion(_updates.head()),
+      _tombstoneFloor(_updates.head()), _batchWorkers(DaemonConfig::getInstance().workerThreads) {
+    const auto& config = DaemonConfig::getInstance();
+    if (config.totalClientRate > 0)
+        _totalQuota = std::make_unique<TokenBucket>(config.totalClientRate, config.totalClientBurst);
+}
+ElgatoServerImpl::~ElgatoServerImpl() = default;
+
 void ElgatoServerImpl::RunServer(const std::string& socketPath) {
-    auto server_address = "unix://" + expand_with_environment(socketPath);
+    auto server_address = "unix://" + DaemonConfig::expand_with_environment(socketPath);
+    const auto& config = DaemonConfig::getInstance();
+
+    AvahiBrowser::getInstance().registerCallback([this](const AvahiBrowserEventArgs& args) { SendFixtureEvent(args); });
+
+    if (config.serverMode != "sync") {
+        _asyncServer = std::make_unique<ElgatoAsyncServer>(*this);
+        _asyncServer->run(server_address, config.completionQueues, config.pollingThreads, config.workerThreads);
+        return;
+    }
 
     std::thread serverThread([this, server_address]{
         ServerBuilder builder;
@@ -65,142 +128,1053 @@ void ElgatoServerImpl::RunServer(const std::string& socketPath) {
     serverThread.detach();
 }
 
-std::string ElgatoServerImpl::expand_with_environment(const std::string &s) {
-    if ( s.find("$[") == std::string::npos) return s;
+void ElgatoServerImpl::fillFixture(const std::shared_ptr<ElgatoLight>& light, Fixture* fixture, bool fetchMissing) {
+    fixture->set_name(light->name());
+    fixture->set_handle(light->handle());
 
-    std::string pre     = s.substr( 0, s.find("$["));
-    std::string post    = s.substr( s.find("$[")+ 2);
+    // Only what is known already. The rest of accessory-info is fetched in the background and arrives as FIXTURE_CHANGED
+    if (fetchMissing && !light->hasCompleteInfo())
+        AvahiBrowser::getInstance().fetchDeviceInfo(light);
 
-    if (post.find(']') == std::string::npos) return s;
-    std::string variable = post.substr( 0, post.find( ']' ) );
-    std::string value   = "";
+    if (light->isReady())
+    {
+        auto info = light->cachedDeviceInfo();
 
-    post = post.substr(post.find(']') + 1);
-    const char *v = getenv( variable.c_str() );
-    if ( v != NULL ) value = std::string( v );
+        fixture->set_isready(true);
+        fixture->set_displayname(info->displayName);
+        fixture->set_productname(info->productName);
+        fixture->set_serialnumber(info->serialNumber);
+        fixture->set_powerstate(light->deviceState()->on == 1);
+        fixture->set_brightness(light->deviceState()->brightness);
+        fixture->set_temperature(ElgatoLight::colorFromElgato(light->deviceState()->temperature));
+    }
+}
 
-    return expand_with_environment(pre + value + post);
+Status ElgatoServerImpl::ListFixtures([[maybe_unused]] ServerContext* _, [[maybe_unused]] const Empty* empty, FixtureList* fixtureList) {
+    auto buffer = serializedFixtures();
+    return grpc::SerializationTraits<FixtureList>::Deserialize(&buffer, fixtureList);
 }
 
-Status ElgatoServerImpl::ListFixtures([[maybe_unused]] ServerContext* _, [[maybe_unused]] const Empty* empty, [[maybe_unused]] FixtureList* fixtureList) {
+Status ElgatoServerImpl::ListFixturesSerialized([[maybe_unused]] ServerContext* _, [[maybe_unused]] const grpc::ByteBuffer* empty, grpc::ByteBuffer* fixtureList) {
+    *fixtureList = serializedFixtures();
+    return Status::OK;
+}
+
+Status ElgatoServerImpl::ListFixturesPaged([[maybe_unused]] ServerContext* _, const ListFixturesRequest* request, FixturePage* page) {
+    std::vector<std::shared_ptr<ElgatoLight>> lights;
+    auto status = pageableLights(*request, lights);
+    if (!status.ok()) return status;
+
+    fillPage(*request, lights, 0, 0, page);
+    return Status::OK;
+}
+
+Status ElgatoServerImpl::StreamFixtures([[maybe_unused]] ServerContext* _, const ListFixturesRequest* request, ::grpc::ServerWriter<FixturePage>* writer) {
+    std::vector<std::shared_ptr<ElgatoLight>> lights;
+    auto status = pageableLights(*request, lights);
+    if (!status.ok()) return status;
+
+    size_t offset = 0;
+    while (offset < lights.size()) {
+        FixturePage page;
+        offset = fillPage(*request, lights, offset, kStreamPageSize, &page);
+        if (!writer->Write(page)) break;
+    }
+
+    return Status::OK;
+}
+
+Status ElgatoServerImpl::pageableLights(const ListFixturesRequest& request, std::vector<std::shared_ptr<ElgatoLight>>& lights) {
+    if (request.has_fieldmask() && !google::protobuf::util::FieldMaskUtil::IsValidFieldMask<Fixture>(request.fieldmask()))
+        return { grpc::StatusCode::INVALID_ARGUMENT, "Field mask names unknown Fixture fields" };
+
+    // The token is the handle of the last fixture on the previous page
+    uint32_t after = 0;
+    if (!request.pagetoken().empty()) {
+        try {
+            after = std::stoul(request.pagetoken());
+        } catch (const std::exception&) {
+            return { grpc::StatusCode::INVALID_ARGUMENT, "Invalid page token" };
+        }
+    }
+
+    lights = AvahiBrowser::getInstance().getLights();
+    lights.erase(std::remove_if(lights.begin(), lights.end(), [after](const auto& light) {
+        return light->handle() <= after;
+    }), lights.end());
+    std::sort(lights.begin(), lights.end(), [](const auto& a, const auto& b) { return a->handle() < b->handle(); });
+
+    return Status::OK;
+}
+
+size_t ElgatoServerImpl::fillPage(const ListFixturesRequest& request, const std::vector<std::shared_ptr<ElgatoLight>>& lights, size_t offset,
+                                  uint32_t pageSize, FixturePage* page) {
+    if (request.pagesize() != 0) pageSize = request.pagesize();
+    auto end = pageSize == 0 ? lights.size() : std::min(lights.size(), offset + pageSize);
+
+    for(auto i = offset; i < end; i++) {
+        auto fixture = page->add_fixtures();
+        fillFixture(lights[i], fixture);
+
+        if (request.has_fieldmask() && request.fieldmask().paths_size() > 0)
+            google::protobuf::util::FieldMaskUtil::TrimMessage(request.fieldmask(), fixture);
+    }
+
+    if (end < lights.size())
+        page->set_nextpagetoken(std::to_string(lights[end - 1]->handle()));
+
+    return end;
+}
+
+uint64_t ElgatoServerImpl::registryVersion() {
+    std::unique_lock<std::mutex> mLock(_versionMutex);
+    return _registryVersion;
+}
+
+// Copies of the buffer share its slices, so a hit neither allocates the list nor touches a light
+grpc::ByteBuffer ElgatoServerImpl::serializedFixtures() {
+    std::unique_lock<std::mutex> mLock(_fixtureCacheMutex);
+
+    // Read before building: a change that races with the build only causes one more rebuild
+    auto version = registryVersion();
+    auto generation = ElgatoLight::stateGeneration();
+    if (_fixtureCacheValid && _fixtureCacheVersion == version && _fixtureCacheGeneration == generation)
+        return _fixtureCache;
+
+    google::protobuf::Arena arena;
+    auto fixtureList = google::protobuf::Arena::CreateMessage<FixtureList>(&arena);
     for(auto& light : AvahiBrowser::getInstance().getLights()) {
-        auto newFix = fixtureList->add_fixtures();
-        newFix->set_name(light->name());
+        fillFixture(light, fixtureList->add_fixtures());
+    }
 
-        if (light->isReady())
-        {
-            newFix->set_isready(true);
-            newFix->set_displayname(light->deviceInfo()->displayName);
-            newFix->set_productname(light->deviceInfo()->productName);
-            newFix->set_serialnumber(light->deviceInfo()->serialNumber);
-            newFix->set_powerstate(light->deviceState()->on == 1);
-            newFix->set_brightness(light->deviceState()->brightness);
-            newFix->set_temperature(ElgatoLight::colorFromElgato(light->deviceState()->temperature));
+    bool ownBuffer;
+    grpc::ByteBuffer buffer;
+    if (!grpc::SerializationTraits<FixtureList>::Serialize(*fixtureList, &buffer, &ownBuffer).ok()) {
+        std::clog << kLogWarning << "Could not serialize the fixture list" << std::endl;
+        return buffer;
+    }
+
+    _fixtureCache.Swap(&buffer);
+    _fixtureCacheVersion = version;
+    _fixtureCacheGeneration = generation;
+    _fixtureCacheValid = true;
+
+    return _fixtureCache;
+}
+
+Status ElgatoServerImpl::ListFixturesSince([[maybe_unused]] ServerContext* _, const FixturesSinceRequest* request, FixtureDelta* delta) {
+    auto& browser = AvahiBrowser::getInstance();
+
+    std::unique_lock<std::mutex> mLock(_versionMutex);
+    auto since = request->version();
+    delta->set_version(_registryVersion);
+
+    if (since == _registryVersion) {
+        delta->set_notmodified(true);
+        return Status::OK;
+    }
+
+    // Unknown versions (0, from a previous daemon or older than the tombstones we kept) get everything
+    if (since < _tombstoneFloor || since > _registryVersion) {
+        mLock.unlock();
+        delta->set_full(true);
+
+        for(auto& light : browser.getLights()) {
+            fillFixture(light, delta->add_fixtures());
         }
+
+        return Status::OK;
+    }
+
+    std::vector<std::string> changed;
+    for(auto& [name, version] : _fixtureVersions) {
+        if (version > since) changed.push_back(name);
+    }
+
+    for(auto& [name, version] : _tombstones) {
+        if (version > since) delta->add_removed(name);
+    }
+    mLock.unlock();
+
+    for(auto& name : changed) {
+        auto light = browser.exactlyNamed(name);
+        if (light != nullptr)
+            fillFixture(light, delta->add_fixtures());
     }
 
     return Status::OK;
 }
 
-Status ElgatoServerImpl::Refresh([[maybe_unused]] ServerContext* _, [[maybe_unused]] const Empty* empty, SimpleCliResponse* response) {
+Status ElgatoServerImpl::Refresh(ServerContext* context, [[maybe_unused]] const Empty* empty, SimpleCliResponse* response) {
+    auto admission = admit(context, 0);
+    if (!admission.status().ok()) return admission.status();
+
     AvahiBrowser::getInstance().restart();
+    SubnetScanner::getInstance().start();
     response->set_successful(true);
     return Status::OK;
 }
 
-Status ElgatoServerImpl::PowerOn([[maybe_unused]] ServerContext* _, [[maybe_unused]] const SimpleCliRequest* request, SimpleCliResponse* response ) {
-    for(auto& light : AvahiBrowser::getInstance().allByName(request->fixturefilter())) {
-        if (light->isReady() && light->powerOn())
-            SendFixtureUpdate(light->name(), "Power", 1);
+Status ElgatoServerImpl::PowerOn(ServerContext* context, [[maybe_unused]] const SimpleCliRequest* request, SimpleCliResponse* response ) {
+    std::vector<std::shared_ptr<ElgatoLight>> lights;
+    auto resolved = resolveTargets(*request, lights);
+    if (!resolved.ok()) return resolved;
+
+    auto admission = admit(context, lights.size());
+    if (!admission.status().ok()) return admission.status();
+
+    auto traffic = trafficOf(context, LightTraffic::Interactive);
+    std::vector<PropertyChange> changes;
+    for(auto& light : lights) {
+        if (light->isReady())
+            applyOperation(light, POWER_ON, 0, traffic, request->force(), changes);
     }
 
+    SendFixtureUpdate(changes, clientIdOf(context));
     response->set_successful(true);
     return Status::OK;
 }
 
-Status ElgatoServerImpl::PowerOff([[maybe_unused]] ServerContext* _, [[maybe_unused]] const SimpleCliRequest* request, SimpleCliResponse* response ) {
-    for(auto& light : AvahiBrowser::getInstance().allByName(request->fixturefilter())) {
-        if (light->isReady() && light->powerOff())
-            SendFixtureUpdate(light->name(), "Power", 0);
+Status ElgatoServerImpl::PowerOff(ServerContext* context, [[maybe_unused]] const SimpleCliRequest* request, SimpleCliResponse* response ) {
+    std::vector<std::shared_ptr<ElgatoLight>> lights;
+    auto resolved = resolveTargets(*request, lights);
+    if (!resolved.ok()) return resolved;
+
+    auto admission = admit(context, lights.size());
+    if (!admission.status().ok()) return admission.status();
+
+    auto traffic = trafficOf(context, LightTraffic::Interactive);
+    std::vector<PropertyChange> changes;
+    for(auto& light : lights) {
+        if (light->isReady())
+            applyOperation(light, POWER_OFF, 0, traffic, request->force(), changes);
     }
 
+    SendFixtureUpdate(changes, clientIdOf(context));
     response->set_successful(true);
     return Status::OK;
 }
 
-Status ElgatoServerImpl::SetBrightness([[maybe_unused]] ServerContext* _, const Int32CliRequest* request, SimpleCliResponse* response) {
-    for(auto& light : AvahiBrowser::getInstance().allByName(request->fixturefilter())) {
-        if (light->isReady() && light->setBrightness(request->newvalue()))
-            SendFixtureUpdate(light->name(), "Brightness", request->newvalue());
+Status ElgatoServerImpl::SetBrightness(ServerContext* context, const Int32CliRequest* request, SimpleCliResponse* response) {
+    std::vector<std::shared_ptr<ElgatoLight>> lights;
+    auto resolved = resolveTargets(*request, lights);
+    if (!resolved.ok()) return resolved;
+
+    auto admission = admit(context, lights.size());
+    if (!admission.status().ok()) return admission.status();
+
+    auto traffic = trafficOf(context, LightTraffic::Interactive);
+    std::vector<PropertyChange> changes;
+    for(auto& light : lights) {
+        if (light->isReady())
+            applyOperation(light, SET_BRIGHTNESS, request->newvalue(), traffic, request->force(), changes);
     }
 
+    SendFixtureUpdate(changes, clientIdOf(context));
     response->set_successful(true);
     return Status::OK;
 }
 
-Status ElgatoServerImpl::SetTemperature([[maybe_unused]] ServerContext* _, const Int32CliRequest* request, SimpleCliResponse* response) {
-    for(auto& light : AvahiBrowser::getInstance().allByName(request->fixturefilter())) {
-        if (light->isReady() && light->setTemperature(request->newvalue()))
-            SendFixtureUpdate(light->name(), "Temperature", request->newvalue());
+Status ElgatoServerImpl::SetTemperature(ServerContext* context, const Int32CliRequest* request, SimpleCliResponse* response) {
+    std::vector<std::shared_ptr<ElgatoLight>> lights;
+    auto resolved = resolveTargets(*request, lights);
+    if (!resolved.ok()) return resolved;
+
+    auto admission = admit(context, lights.size());
+    if (!admission.status().ok()) return admission.status();
+
+    auto traffic = trafficOf(context, LightTraffic::Interactive);
+    std::vector<PropertyChange> changes;
+    for(auto& light : lights) {
+        if (light->isReady())
+            applyOperation(light, SET_TEMPERATURE, request->newvalue(), traffic, request->force(), changes);
+    }
+
+    SendFixtureUpdate(changes, clientIdOf(context));
+    response->set_successful(true);
+    return Status::OK;
+}
+
+Status ElgatoServerImpl::ApplyBatch(ServerContext* context, const BatchRequest* request, BatchResponse* response) {
+    auto successful = true;
+
+    // Group the commands per light so each light sees them in order
+    std::map<std::shared_ptr<ElgatoLight>, std::vector<int>> commandsPerLight;
+
+    for(int i = 0; i < request->commands_size(); i++) {
+        if (!isKnownOperation(request->commands(i).operation()))
+            return { grpc::StatusCode::INVALID_ARGUMENT, fmt::format("Command {} has no known operation", i) };
+    }
+
+    for(int i = 0; i < request->commands_size(); i++) {
+        std::vector<std::shared_ptr<ElgatoLight>> lights;
+
+        try {
+            lights = targetsOf(request->commands(i));
+        } catch(const std::regex_error& e) {
+            auto result = response->add_results();
+            result->set_command(i);
+            result->set_error(std::string("Invalid filter: ") + e.what());
+            successful = false;
+            continue;
+        }
+
+        if (lights.empty()) {
+            auto result = response->add_results();
+            result->set_command(i);
+            result->set_error("No fixture matches");
+            successful = false;
+        }
+
+        for(auto& light : lights) {
+            commandsPerLight[light].push_back(i);
+        }
+    }
+
+    size_t operations = 0;
+    for(auto& [light, commands] : commandsPerLight) {
+        operations += commands.size();
+    }
+
+    auto admission = admit(context, operations);
+    if (!admission.status().ok()) return admission.status();
+
+    auto traffic = trafficOf(context, LightTraffic::Automation);
+    using LightOutcome = std::pair<std::vector<FixtureResult>, std::vector<PropertyChange>>;
+    std::vector<std::future<LightOutcome>> pending;
+
+    for(auto& [light, commands] : commandsPerLight) {
+        auto group = std::make_shared<std::packaged_task<LightOutcome()>>([this, request, traffic, light = light, commands = commands] {
+            std::vector<FixtureResult> results;
+            std::vector<PropertyChange> changes;
+
+            for(auto index : commands) {
+                auto& command = request->commands(index);
+                FixtureResult result;
+                result.set_command(index);
+                result.set_fixturename(light->name());
+
+                auto start = std::chrono::steady_clock::now();
+                if (!light->isReady())
+                    result.set_error("Fixture not ready");
+                else if (!applyOperation(light, command.operation(), command.value(), traffic, command.force(), changes))
+                    result.set_error("Request to fixture failed");
+                else
+                    result.set_successful(true);
+
+                result.set_latencyus(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+                results.push_back(result);
+            }
+
+            return LightOutcome(results, changes);
+        });
+
+        pending.push_back(group->get_future());
+        _batchWorkers.submit([group] { (*group)(); });
+    }
+
+    // Everything the batch changed goes out as a single update
+    std::vector<FixtureResult> results;
+    std::vector<PropertyChange> changes;
+
+    for(auto& future : pending) {
+        auto [lightResults, lightChanges] = future.get();
+
+        for(auto& result : lightResults) {
+            successful &= result.successful();
+            results.push_back(result);
+        }
+
+        changes.insert(changes.end(), lightChanges.begin(), lightChanges.end());
+    }
+
+    SendFixtureUpdate(changes, clientIdOf(context));
+
+    std::stable_sort(results.begin(), results.end(), [](const FixtureResult& a, const FixtureResult& b) {
+        return a.command() < b.command();
+    });
+
+    for(auto& result : results) {
+        *response->add_results() = result;
+    }
+
+    response->set_successful(successful);
+    return Status::OK;
+}
+
+Status ElgatoServerImpl::StreamControl(ServerContext* context, ::grpc::ServerReader<ControlCommand>* reader, SimpleCliResponse* response) {
+    ControlCommand command;
+    auto clientId = clientIdOf(context);
+
+    while(reader->Read(&command)) {
+        auto status = queueControl(command, clientId);
+        if (!status.ok()) return status;
     }
 
     response->set_successful(true);
     return Status::OK;
 }
 
-Status ElgatoServerImpl::ObserveChanges([[maybe_unused]] ::grpc::ServerContext* context, [[maybe_unused]] const Empty* emptyRequest, ::grpc::ServerWriter<FixtureUpdate>* writer) {
+Status ElgatoServerImpl::queueControl(const ControlCommand& command, const std::string& clientId) {
+    if (!isKnownOperation(command.operation()))
+        return { grpc::StatusCode::INVALID_ARGUMENT, "Command has no known operation" };
+
+    std::vector<std::shared_ptr<ElgatoLight>> lights;
+
+    try {
+        lights = targetsOf(command);
+    } catch(const std::regex_error& e) {
+        std::clog << kLogWarning << "Invalid fixture filter " << command.fixturefilter() << ": " << e.what() << std::endl;
+        return Status::OK;
+    }
+
+    auto property = LightProperty::Power;
+    auto value = command.value();
+
+    switch(command.operation()) {
+        case POWER_ON:
+            value = 1;
+            break;
+        case POWER_OFF:
+            value = 0;
+            break;
+        case SET_BRIGHTNESS:
+            property = LightProperty::Brightness;
+            break;
+        case SET_TEMPERATURE:
+            property = LightProperty::Temperature;
+            break;
+        default:
+            return { grpc::StatusCode::INVALID_ARGUMENT, "Command has no known operation" };
+    }
+
+    for(auto& light : lights) {
+        if (!light->isReady()) continue;
+
+        light->queueWrite(property, value, clientId, [this, name = light->name(), handle = light->handle(), clientId](const std::map<LightProperty, uint32_t>& applied) {
+            std::vector<PropertyChange> changes;
+
+            for(auto& [appliedProperty, appliedValue] : applied) {
+                switch(appliedProperty) {
+                    case LightProperty::Power:
+                        changes.push_back(makeChange(name, handle, POWER, appliedValue));
+                        break;
+                    case LightProperty::Brightness:
+                        changes.push_back(makeChange(name, handle, BRIGHTNESS, appliedValue));
+                        break;
+                    case LightProperty::Temperature:
+                        changes.push_back(makeChange(name, handle, TEMPERATURE, appliedValue));
+                        break;
+                }
+            }
+
+            SendFixtureUpdate(changes, clientId);
+        }, command.force());
+    }
+
+    return Status::OK;
+}
+
+// Sends the request to the light and records the change when it was accepted and not elided, the caller publishes them together.
+// The recorded value is the one the light was set to, a write merged into the same request may have replaced ours
+bool ElgatoServerImpl::applyOperation(const std::shared_ptr<ElgatoLight>& light, FixtureOperation operation, uint32_t value,
+                                      LightTraffic traffic, bool force, std::vector<PropertyChange>& changes) {
+    WriteResult result;
+    auto property = LightProperty::Power;
+    auto changed = POWER;
+
+    switch(operation) {
+        case POWER_ON:
+            result = light->powerOn(traffic, force);
+            break;
+        case POWER_OFF:
+            result = light->powerOff(traffic, force);
+            break;
+        case SET_BRIGHTNESS:
+            result = light->setBrightness(value, traffic, force);
+            property = LightProperty::Brightness;
+            changed = BRIGHTNESS;
+            break;
+        case SET_TEMPERATURE:
+            result = light->setTemperature(value, traffic, force);
+            property = LightProperty::Temperature;
+            changed = TEMPERATURE;
+            break;
+        default:
+            return false;
+    }
+
+    if (!result.successful) return false;
+    // Nothing changed, so there is nothing to publish
+    if (result.elided) return true;
+
+    changes.push_back(makeChange(light->name(), light->handle(), changed, result.applied.at(property)));
+    return true;
+}
+
+std::string ElgatoServerImpl::clientIdOf(const ServerContext* context) {
+    const auto& metadata = context->client_metadata();
+    auto it = metadata.find(CLIENT_ID_METADATA);
+
+    return it == metadata.end() ? std::string() : std::string(it->second.data(), it->second.size());
+}
+
+ElgatoServerImpl::Admission ElgatoServerImpl::admit(ServerContext* context, size_t operations) {
+    const auto& config = DaemonConfig::getInstance();
+    std::chrono::microseconds retryAfter(0);
+
+    // A request that works on more lights than the limit allows waits until nothing else runs
+    uint32_t counted = 0;
+    if (config.maxInflightOperations > 0 && operations > 0) {
+        counted = static_cast<uint32_t>(std::min<size_t>(operations, config.maxInflightOperations));
+
+        if ((_inflight += counted) > config.maxInflightOperations) {
+            _inflight -= counted;
+            _overloaded++;
+            context->AddTrailingMetadata(RETRY_AFTER_METADATA, std::to_string(kOverloadRetryAfter.count()));
+            return { { grpc::StatusCode::RESOURCE_EXHAUSTED, "Too many operations in flight" }, nullptr };
+        }
+    }
+
+    if (config.clientRate > 0) {
+        // The id is whatever the client says it is, _totalQuota keeps made up ids from adding up
+        auto key = clientIdOf(context);
+        if (key.empty()) key = context->peer();
+
+        std::unique_lock<std::mutex> mLock(_quotaMutex);
+        auto& quota = _quotas[key];
+        if (quota == nullptr) {
+            quota = std::make_shared<TokenBucket>(config.clientRate, config.clientBurst);
+
+            // Clients with a full bucket have been quiet long enough to start over
+            if (_quotas.size() > kQuotaLimit) {
+                for(auto it = _quotas.begin(); it != _quotas.end(); ) {
+                    it = it->first != key && it->second->isFull() ? _quotas.erase(it) : std::next(it);
+                }
+            }
+        }
+        auto bucket = quota;
+        mLock.unlock();
+
+        auto admitted = bucket->tryTake(retryAfter);
+        if (admitted && _totalQuota && !_totalQuota->tryTake(retryAfter)) {
+            bucket->refund();
+            admitted = false;
+        }
+
+        if (!admitted) {
+            _inflight -= counted;
+            _overQuota++;
+            auto retryAfterMs = std::chrono::duration_cast<std::chrono::milliseconds>(retryAfter).count() + 1;
+            context->AddTrailingMetadata(RETRY_AFTER_METADATA, std::to_string(retryAfterMs));
+            return { { grpc::StatusCode::RESOURCE_EXHAUSTED, fmt::format("Request quota exceeded, retry in {}ms", retryAfterMs) }, nullptr };
+        }
+    }
+
+    return { Status::OK, counted > 0 ? &_inflight : nullptr, counted };
+}
+
+LightTraffic ElgatoServerImpl::trafficOf(const ServerContext* context, LightTraffic fallback) {
+    const auto& metadata = context->client_metadata();
+    auto it = metadata.find(TRAFFIC_CLASS_METADATA);
+    if (it == metadata.end()) return fallback;
+
+    auto value = std::string(it->second.data(), it->second.size());
+    if (value == "interactive") return LightTraffic::Interactive;
+    if (value == "automation") return LightTraffic::Automation;
+    if (value == "poll") return LightTraffic::Poll;
+
+    return fallback;
+}
+
+PropertyChange ElgatoServerImpl::makeChange(const std::string& fixtureName, uint32_t handle, FixtureProperty property, int32_t newValue) {
+    PropertyChange change;
+    change.set_fixturename(fixtureName);
+    change.set_handle(handle);
+    change.set_property(property);
+    change.set_newvalue(newValue);
+
+    return change;
+}
+
+bool ElgatoServerImpl::ClientConnection::tryGetMessage(std::shared_ptr<const FixtureUpdate>& message) {
+    std::unique_lock<std::mutex> mLock(_mutex);
+
+    while(nextMessage(message)) {
+        if (message->clientid() == _clientId) {
+            _echoesSuppressed++;
+            continue;
+        }
+
+        if (_filtered) message = filter(message);
+        if (message == nullptr) continue;
+
+        if (_handlesOnly) message = withoutNames(message);
+        return true;
+    }
+
+    return false;
+}
+
+// Called with _mutex held
+bool ElgatoServerImpl::ClientConnection::nextMessage(std::shared_ptr<const FixtureUpdate>& message) {
+    if (_resyncRequired) return false;
+
+    auto head = _updates.head();
+    if (head - _cursor > _capacity) {
+        switch(_policy) {
+            case DISCONNECT:
+                std::clog << kLogWarning << "Client " << _clientId << " is " << head - _cursor << " update(s) behind, disconnecting" << std::endl;
+                _dropped += head - _cursor;
+                _resyncRequired = true;
+                return false;
+            case COALESCE:
+                coalesce(head);
+                break;
+            default:
+                _dropped += head - _capacity - _cursor;
+                _cursor = head - _capacity;
+                break;
+        }
+    }
+
+    if (!_coalesced.empty()) {
+        message = _coalesced.front();
+        _coalesced.pop_front();
+        return true;
+    }
+
+    auto result = _updates.read(_cursor, message);
+
+    while (result == UpdateRing::ReadResult::Overrun) {
+        // Lost to the ring before we got here, continue with the oldest update still available
+        auto oldest = _updates.oldest();
+        _dropped += oldest - _cursor - 1;
+        _cursor = oldest - 1;
+        result = _updates.read(_cursor, message);
+    }
+
+    return result == UpdateRing::ReadResult::Ok;
+}
+
+void ElgatoServerImpl::ClientConnection::coalesce(uint64_t head) {
+    std::vector<std::shared_ptr<const FixtureUpdate>> backlog(_coalesced.begin(), _coalesced.end());
+    std::shared_ptr<const FixtureUpdate> update;
+
+    while (_cursor < head) {
+        auto result = _updates.read(_cursor, update);
+        if (result == UpdateRing::ReadResult::Empty) break;
+
+        if (result == UpdateRing::ReadResult::Overrun) {
+            auto oldest = _updates.oldest();
+            _dropped += oldest - _cursor - 1;
+            _cursor = oldest - 1;
+            continue;
+        }
+
+        backlog.push_back(update);
+    }
+
+    // Walk backwards so the latest value per fixture and property wins, membership events share one key
+    std::set<std::pair<std::string, int>> seen;
+    _coalesced.clear();
+
+    for(auto it = backlog.rbegin(); it != backlog.rend(); it++) {
+        auto& update = **it;
+
+        if (update.eventtype() != PROPERTY_CHANGED) {
+            if (seen.emplace(update.fixturename(), -1).second)
+                _coalesced.push_front(*it);
+            else
+                _dropped++;
+
+            continue;
+        }
+
+        std::vector<int> keep;
+        for(int i = update.changes_size() - 1; i >= 0; i--) {
+            if (seen.emplace(update.changes(i).fixturename(), update.changes(i).property()).second)
+                keep.insert(keep.begin(), i);
+        }
+
+        _dropped += update.changes_size() - keep.size();
+
+        if (keep.empty()) continue;
+
+        if ((int)keep.size() == update.changes_size()) {
+            _coalesced.push_front(*it);
+            continue;
+        }
+
+        auto trimmed = std::make_shared<FixtureUpdate>(update);
+        trimmed->clear_changes();
+        for(auto index : keep) {
+            *trimmed->add_changes() = update.changes(index);
+        }
+
+        _coalesced.push_front(trimmed);
+    }
+}
+
+void ElgatoServerImpl::ClientConnection::setFilter(const std::string& fixtureFilter, const std::vector<FixtureProperty>& properties, bool handlesOnly) {
+    _filtered = !fixtureFilter.empty() || !properties.empty();
+    _fixtureFilter = std::regex(fixtureFilter.empty() || fixtureFilter == "*" ? "." : fixtureFilter);
+    _properties = std::set<int>(properties.begin(), properties.end());
+    _handlesOnly = handlesOnly;
+}
+
+bool ElgatoServerImpl::ClientConnection::matches(const std::string& fixtureName) const {
+    return std::regex_search(fixtureName, _fixtureFilter);
+}
+
+bool ElgatoServerImpl::ClientConnection::matches(const PropertyChange& change) const {
+    return (_properties.empty() || _properties.count(change.property()) > 0) && matches(change.fixturename());
+}
+
+bool ElgatoServerImpl::ClientConnection::offer(const FixtureUpdate& update, uint64_t sequence) {
+    auto echo = update.clientid() == _clientId;
+
+    if (!echo && !_filtered) return true;
+
+    if (!echo && update.eventtype() != PROPERTY_CHANGED) {
+        if (matches(update.fixturename())) return true;
+    } else if (!echo) {
+        for(auto& change : update.changes()) {
+            if (matches(change)) return true;
+        }
+    }
+
+    std::unique_lock<std::mutex> mLock(_mutex);
+    if (_cursor + 1 == sequence && _coalesced.empty()) {
+        _cursor = sequence;
+        if (echo) _echoesSuppressed++;
+    }
+
+    return false;
+}
+
+std::shared_ptr<const FixtureUpdate> ElgatoServerImpl::ClientConnection::filter(const std::shared_ptr<const FixtureUpdate>& update) const {
+    if (update->eventtype() != PROPERTY_CHANGED)
+        return matches(update->fixturename()) ? update : nullptr;
+
+    std::vector<int> keep;
+    for(int i = 0; i < update->changes_size(); i++) {
+        if (matches(update->changes(i))) keep.push_back(i);
+    }
+
+    if (keep.empty()) return nullptr;
+    if ((int)keep.size() == update->changes_size()) return update;
+
+    auto trimmed = std::make_shared<FixtureUpdate>(*update);
+    trimmed->clear_changes();
+    for(auto index : keep) {
+        *trimmed->add_changes() = update->changes(index);
+    }
+
+    return trimmed;
+}
+
+// The ring holds one update for every subscriber, so the names are only dropped from this subscriber's copy
+std::shared_ptr<const FixtureUpdate> ElgatoServerImpl::ClientConnection::withoutNames(const std::shared_ptr<const FixtureUpdate>& update) {
+    if (update->eventtype() != PROPERTY_CHANGED) return update;
+
+    auto trimmed = std::make_shared<FixtureUpdate>(*update);
+    trimmed->clear_fixturename();
+    for(auto& change : *trimmed->mutable_changes()) {
+        change.clear_fixturename();
+    }
+
+    return trimmed;
+}
+
+bool ElgatoServerImpl::ClientConnection::waitForMessage(std::shared_ptr<const FixtureUpdate>& message, std::chrono::milliseconds timeout) {
+    if (tryGetMessage(message)) return true;
+    if (resyncRequired()) return false;
+
+    std::unique_lock<std::mutex> mLock(_mutex);
+    auto cursor = _cursor;
+    mLock.unlock();
+
+    return _updates.waitFor(cursor, timeout) && tryGetMessage(message);
+}
+
+bool ElgatoServerImpl::ClientConnection::resyncRequired() const {
+    std::unique_lock<std::mutex> mLock(_mutex);
+    return _resyncRequired;
+}
+
+FixtureUpdate ElgatoServerImpl::ClientConnection::helloMessage() const {
+    std::unique_lock<std::mutex> mLock(_mutex);
+
+    FixtureUpdate hello;
+    hello.set_clientid(_clientId);
+    hello.set_sequence(_cursor);
+    hello.set_resyncrequired(_stale);
+    if (_snapshot) *hello.mutable_snapshot() = *_snapshot;
+
+    return hello;
+}
+
+void ElgatoServerImpl::ClientConnection::takeSnapshot(const std::vector<std::shared_ptr<ElgatoLight>>& lights) {
+    std::unique_lock<std::mutex> mLock(_mutex);
+
+    _snapshot = std::make_unique<FixtureList>();
+    for(auto& light : lights) {
+        if (matches(light->name()))
+            fillFixture(light, _snapshot->add_fixtures());
+    }
+}
+
+FixtureUpdate ElgatoServerImpl::ClientConnection::resyncHint() const {
+    FixtureUpdate hint;
+    hint.set_clientid(_clientId);
+    hint.set_resyncrequired(true);
+
+    return hint;
+}
+
+void ElgatoServerImpl::ClientConnection::fillStats(SubscriberStats* stats) const {
+    std::unique_lock<std::mutex> mLock(_mutex);
+    auto head = _updates.head();
+
+    stats->set_clientid(_clientId);
+    stats->set_policy(_policy);
+    stats->set_capacity(_capacity);
+    stats->set_depth(head - _cursor + _coalesced.size());
+    stats->set_dropped(_dropped);
+    stats->set_echoessuppressed(_echoesSuppressed);
+}
+
+std::shared_ptr<ElgatoServerImpl::ClientConnection> ElgatoServerImpl::subscribe(const ObserveRequest& request, std::function<void()> onMessage) {
+    const auto& config = DaemonConfig::getInstance();
+
+    auto policy = request.policy();
+    if (policy == POLICY_DEFAULT) {
+        if (config.subscriberPolicy == "dropOldest")
+            policy = DROP_OLDEST;
+        else if (config.subscriberPolicy == "disconnect")
+            policy = DISCONNECT;
+        else
+            policy = COALESCE;
+    }
+
+    auto capacity = request.capacity() > 0 ? request.capacity() : config.subscriberCapacity;
+    capacity = std::min<uint32_t>(capacity, _updates.capacity());
+
+    // Replay from resumeFrom if the ring still has everything after it. Only a coalescing subscriber may start more
+    // than capacity behind, the others would lose part of the replay right away.
+    auto head = _updates.head();
+    auto cursor = head;
+    auto stale = false;
+
+    if (request.resumefrom() > 0 && !request.snapshot()) {
+        auto resumeFrom = request.resumefrom();
+
+        if (resumeFrom > head || resumeFrom + 1 < _updates.oldest() || (head - resumeFrom > capacity && policy != COALESCE))
+            stale = true;
+        else
+            cursor = resumeFrom;
+    }
+
     // Create a client id
     uuid_t uuid;
     uuid_generate(uuid);
     char uuidString[37];
     uuid_unparse(uuid, uuidString);
 
+    auto clientConnection = std::make_shared<ClientConnection>(uuidString, _updates, policy, capacity, cursor, stale, std::move(onMessage));
+
+    std::vector<FixtureProperty> properties;
+    for(auto property : request.properties()) {
+        properties.push_back(static_cast<FixtureProperty>(property));
+    }
+
+    try {
+        clientConnection->setFilter(request.fixturefilter(), properties, request.handlesonly());
+    } catch(const std::regex_error& e) {
+        std::clog << kLogWarning << "Invalid fixture filter " << request.fixturefilter() << ": " << e.what() << std::endl;
+        return nullptr;
+    }
+
+    if (request.snapshot())
+        clientConnection->takeSnapshot(AvahiBrowser::getInstance().getLights());
+
     std::unique_lock<std::mutex> mLock(_connectionMutex);
-    auto clientConnection = ClientConnection(uuidString);
     _connections.push_back(clientConnection);
     mLock.unlock();
 
 #if DEBUG_BUILD
-    std::clog << kLogNotice << "Client " << uuidString << "connected." << std::endl;
+    std::clog << kLogNotice << "Client " << uuidString << " connected." << std::endl;
 #endif
 
-    FixtureUpdate clientIdResponse;
-    clientIdResponse.set_clientid(uuidString);
-    writer->Write(clientIdResponse);
+    return clientConnection;
+}
 
-    // How to do it - good question :)
-    while(!context->IsCancelled()) {
-        auto message = clientConnection.getMessage();
-        if (!context->IsCancelled())
-            writer->Write(message);
-    }
+void ElgatoServerImpl::unsubscribe(const std::string& clientId) {
+    std::unique_lock<std::mutex> mLock(_connectionMutex);
+    _connections.erase(
+            std::remove_if(_connections.begin(), _connections.end(), [&clientId](const std::shared_ptr<ClientConnection>& item) {
+                return item->clientId() == clientId;
+            }), _connections.end());
+    mLock.unlock();
 
 #if DEBUG_BUILD
-    std::clog << kLogNotice << "Client " << uuidString << "disconnected." << std::endl;
+    std::clog << kLogNotice << "Client " << clientId << " disconnected." << std::endl;
 #endif
+}
 
-    mLock.lock();
-    _connections.erase(
-            std::remove_if(_connections.begin(), _connections.end(), [uuidString](const ClientConnection& item) {
-                return item.clientId() == uuidString;
-            }), _connections.end());
-    mLock.unlock();
+Status ElgatoServerImpl::ObserveChanges([[maybe_unused]] ::grpc::ServerContext* context, const ObserveRequest* request, ::grpc::ServerWriter<FixtureUpdate>* writer) {
+    auto clientConnection = subscribe(*request);
+    if (clientConnection == nullptr)
+        return { grpc::StatusCode::INVALID_ARGUMENT, "Invalid fixture filter" };
+
+    writer->Write(clientConnection->helloMessage());
+
+    std::shared_ptr<const FixtureUpdate> message;
+    while(!context->IsCancelled() && !clientConnection->resyncRequired()) {
+        if (clientConnection->waitForMessage(message, 1s))
+            writer->Write(*message);
+    }
+
+    unsubscribe(clientConnection->clientId());
+
+    if (clientConnection->resyncRequired()) {
+        writer->WriteLast(clientConnection->resyncHint(), grpc::WriteOptions());
+        return resyncStatus();
+    }
 
     return Status::OK;
 }
 
-void ElgatoServerImpl::SendFixtureUpdate(std::string fixtureName, std::string propertyName, int32_t newValue) {
-    std::thread notifyThread([this, fixtureName, propertyName, newValue]{
-        FixtureUpdate update;
-        update.set_fixturename(fixtureName);
-        update.set_propertyname(propertyName);
-        update.set_newvalue(newValue);
+Status ElgatoServerImpl::resyncStatus() {
+    return { grpc::StatusCode::ABORTED, "Subscriber fell too far behind, reload with ListFixtures" };
+}
+
+Status ElgatoServerImpl::GetStats([[maybe_unused]] ServerContext* _, [[maybe_unused]] const Empty* empty, DaemonStats* stats) {
+    auto& browser = AvahiBrowser::getInstance();
+    auto discovery = stats->mutable_discovery();
+
+    for(auto& light : browser.getLights()) {
+        discovery->set_knownlights(discovery->knownlights() + 1);
+        if (light->isLost())
+            discovery->set_lostlights(discovery->lostlights() + 1);
+
+        auto lightStats = stats->add_lights();
+        lightStats->set_name(light->name());
+        lightStats->set_handle(light->handle());
+        lightStats->set_writeselided(light->writesElided());
+        lightStats->set_hedgesissued(light->hedgesIssued());
+        lightStats->set_hedgeswon(light->hedgesWon());
+        lightStats->set_srttus(light->rttEstimator().srtt().count());
+        lightStats->set_rttvarus(light->rttEstimator().rttvar().count());
+        lightStats->set_requesttimeoutms(light->requestTimeout().count());
+        lightStats->set_connecttimeoutms(light->connectTimeout().count());
+    }
 
-        std::unique_lock<std::mutex> mLock(_connectionMutex);
-        for(auto& clientConnection : _connections) {
-            clientConnection.pushMessage(update);
+    discovery->set_flapsabsorbed(browser.flapsAbsorbed());
+    discovery->set_lightsexpired(browser.lightsExpired());
+    discovery->set_duplicatesskipped(browser.duplicatesSkipped());
+
+    for(auto trafficClass : { INTERACTIVE, AUTOMATION, POLL }) {
+        auto& histogram = RequestScheduler::queueLatency(static_cast<LightTraffic>(trafficClass));
+        auto traffic = stats->add_traffic();
+
+        traffic->set_trafficclass(trafficClass);
+        traffic->set_requests(histogram.total());
+        for(size_t i = 0; i < LatencyHistogram::buckets(); i++) {
+            auto bucket = traffic->add_queuelatency();
+            bucket->set_upperboundus(i < LatencyHistogram::kBoundsUs.size() ? LatencyHistogram::kBoundsUs[i] : 0);
+            bucket->set_count(histogram.count(i));
         }
+    }
+
+    auto admission = stats->mutable_admission();
+    admission->set_inflight(_inflight);
+    admission->set_overquota(_overQuota);
+    admission->set_overloaded(_overloaded);
+
+    std::unique_lock<std::mutex> mLock(_connectionMutex);
+    for(auto& clientConnection : _connections) {
+        clientConnection->fillStats(stats->add_subscribers());
+    }
+
+    return Status::OK;
+}
+
+void ElgatoServerImpl::SendFixtureUpdate(const std::vector<PropertyChange>& changes, const std::string& originClientId) {
+    if (changes.empty()) return;
+
+    FixtureUpdate update;
+    update.set_clientid(originClientId);
+    update.set_eventtype(PROPERTY_CHANGED);
+    for(auto& change : changes) {
+        *update.add_changes() = change;
+    }
+
+    broadcast(update);
+}
+
+void ElgatoServerImpl::SendFixtureEvent(const AvahiBrowserEventArgs& args) {
+    FixtureUpdate update;
+    update.set_fixturename(args.name());
+    update.set_handle(AvahiBrowser::getInstance().handleOf(args.name()));
+
+    if (args.type() == AvahiBrowserEventType::LIGHT_ADDED || args.type() == AvahiBrowserEventType::LIGHT_CHANGED) {
+        auto light = AvahiBrowser::getInstance().exactlyNamed(args.name());
+        if (light == nullptr) return;
+
+        update.set_eventtype(args.type() == AvahiBrowserEventType::LIGHT_ADDED ? FIXTURE_ADDED : FIXTURE_CHANGED);
+        fillFixture(light, update.mutable_fixture(), false);
+    } else {
+        update.set_eventtype(FIXTURE_REMOVED);
+    }
+
+    broadcast(update);
+}
+
+void ElgatoServerImpl::broadcast(const FixtureUpdate& update) {
+    auto sequence = _updates.publishWith([this, &update](uint64_t sequence) {
+        auto stamped = std::make_shared<FixtureUpdate>(update);
+        stamped->set_sequence(sequence);
+        updateVersions(update, sequence);
+        return std::shared_ptr<const FixtureUpdate>(stamped);
     });
 
-    notifyThread.detach();
+    std::unique_lock<std::mutex> mLock(_connectionMutex);
+    for(auto& clientConnection : _connections) {
+        if (clientConnection->offer(update, sequence))
+            clientConnection->notify();
+    }
+}
+
+// Runs while the ring is locked, so versions are recorded in publish order
+void ElgatoServerImpl::updateVersions(const FixtureUpdate& update, uint64_t sequence) {
+    std::unique_lock<std::mutex> mLock(_versionMutex);
+    _registryVersion = sequence;
+
+    if (update.eventtype() == PROPERTY_CHANGED) {
+        for(auto& change : update.changes()) {
+            _fixtureVersions[change.fixturename()] = sequence;
+        }
+
+        return;
+    }
+
+    if (update.eventtype() == FIXTURE_ADDED || update.eventtype() == FIXTURE_CHANGED) {
+        _fixtureVersions[update.fixturename()] = sequence;
+        _tombstones.erase(update.fixturename());
+        return;
+    }
+
+    _fixtureVersions.erase(update.fixturename());
+    _tombstones[update.fixturename()] = sequence;
+
+    if (_tombstones.size() > kTombstoneLimit) {
+        auto oldest = std::min_element(_tombstones.begin(), _tombstones.end(), [](const auto& a, const auto& b) {
+            return a.second < b.second;
+        });
+
+        _tombstoneFloor = oldest->second;
+        _tombstones.erase(oldest);
+    }
 }
\ No newline at end of file
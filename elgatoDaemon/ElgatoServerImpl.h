@@ -27,54 +27,215 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <grpcpp/support/byte_buffer.h>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <regex>
+#include <set>
 #include <utility>
 
-#include "SharedQueue.h"
+#include "AvahiBrowser.h"
+#include "BroadcastRing.h"
+#include "TokenBucket.h"
+#include "WorkerPool.h"
 #include "elgato.grpc.pb.h"
 #include "elgato.pb.h"
 
+class ElgatoAsyncServer;
+
 class ElgatoServerImpl final : public Elgato::Service {
 public:
-    void RunServer(const std::string&);
-    void SendFixtureUpdate(std::string, std::string, int32_t);
-
-    ::grpc::Status ListFixtures(::grpc::ServerContext*, const Empty*, FixtureList*) override;
-    ::grpc::Status Refresh(::grpc::ServerContext*, const Empty*, SimpleCliResponse*) override;
+    using UpdateRing = BroadcastRing<std::shared_ptr<const FixtureUpdate>>;
 
-    ::grpc::Status PowerOn(::grpc::ServerContext*, const SimpleCliRequest*, SimpleCliResponse*) override;
-    ::grpc::Status PowerOff(::grpc::ServerContext*, const SimpleCliRequest*, SimpleCliResponse*) override;
-    ::grpc::Status SetBrightness(::grpc::ServerContext*, const Int32CliRequest*, SimpleCliResponse*) override;
-    ::grpc::Status SetTemperature(::grpc::ServerContext*, const Int32CliRequest*, SimpleCliResponse*) override;
-    ::grpc::Status ObserveChanges(::grpc::ServerContext*, const Empty*, ::grpc::ServerWriter<FixtureUpdate>*) override;
-private:
+    // A subscriber only owns a cursor into the shared update ring and falls back to its policy when it lags
+    // more than capacity updates behind
     class ClientConnection {
     public:
-        explicit ClientConnection(std::string clientId) : _clientId(std::move(clientId)), _messages(std::make_shared<SharedQueue<FixtureUpdate>>()) { }
+        // onMessage is called after every publish, the async server uses it to wake up an idle stream
+        ClientConnection(std::string clientId, const UpdateRing& updates, BackpressurePolicy policy, uint32_t capacity,
+                         uint64_t cursor, bool stale, std::function<void()> onMessage = nullptr)
+            : _clientId(std::move(clientId)), _updates(updates), _policy(policy), _capacity(capacity), _stale(stale),
+              _onMessage(std::move(onMessage)), _cursor(cursor) { }
 
-        void pushMessage(const FixtureUpdate& message) {
-            _messages->push_back(message);
-        }
+        ClientConnection(const ClientConnection&) = delete;
+        ClientConnection& operator=(const ClientConnection&) = delete;
 
-        bool hasMessages() {
-            return !_messages->empty();
+        void notify() const {
+            if (_onMessage) _onMessage();
         }
 
-        FixtureUpdate getMessage() {
-            auto msg = _messages->front();
-            _messages->pop_front();
+        // Written before anything else, carries the client id and where the stream starts
+        FixtureUpdate helloMessage() const;
 
-            return msg;
-        }
+        // Must be set before the connection is shared, throws std::regex_error for an invalid filter. With handlesOnly
+        // property changes are sent without their fixture name.
+        void setFilter(const std::string& fixtureFilter, const std::vector<FixtureProperty>& properties, bool handlesOnly);
+        // Sent with the hello message. Must be taken after the cursor was chosen, so nothing falls between the two.
+        void takeSnapshot(const std::vector<std::shared_ptr<ElgatoLight>>& lights);
+
+        // Called for every publish. Returns whether the update is of interest, otherwise a caught up subscriber
+        // just moves past it without being woken up.
+        bool offer(const FixtureUpdate& update, uint64_t sequence);
+
+        bool tryGetMessage(std::shared_ptr<const FixtureUpdate>& message);
+
+        // Blocks for at most timeout, used by the thread-per-call server
+        bool waitForMessage(std::shared_ptr<const FixtureUpdate>& message, std::chrono::milliseconds timeout);
+
+        // Set once a DISCONNECT subscriber fell behind, the stream has to be closed
+        bool resyncRequired() const;
+        FixtureUpdate resyncHint() const;
+
+        void fillStats(SubscriberStats*) const;
 
         [[nodiscard]] std::string clientId() const { return _clientId; }
 
     private:
+        bool nextMessage(std::shared_ptr<const FixtureUpdate>& message);
+        void coalesce(uint64_t head);
+
+        bool matches(const std::string& fixtureName) const;
+        bool matches(const PropertyChange& change) const;
+        // nullptr if nothing in the update is of interest, a trimmed copy if only some changes are
+        std::shared_ptr<const FixtureUpdate> filter(const std::shared_ptr<const FixtureUpdate>& update) const;
+        // Copy of a property change update without the fixture names, other events are returned as they are
+        static std::shared_ptr<const FixtureUpdate> withoutNames(const std::shared_ptr<const FixtureUpdate>& update);
+
         std::string _clientId;
-        std::shared_ptr<SharedQueue<FixtureUpdate>> _messages;
+        const UpdateRing& _updates;
+        BackpressurePolicy _policy;
+        uint32_t _capacity;
+        bool _stale;
+        std::function<void()> _onMessage;
+
+        bool _filtered = false;
+        std::regex _fixtureFilter;
+        std::set<int> _properties;
+        bool _handlesOnly = false;
+        std::unique_ptr<FixtureList> _snapshot;
+
+        mutable std::mutex _mutex;
+        uint64_t _cursor;
+        std::deque<std::shared_ptr<const FixtureUpdate>> _coalesced;
+        uint64_t _dropped = 0;
+        uint64_t _echoesSuppressed = 0;
+        bool _resyncRequired = false;
+    };
+
+    // Held while a control request runs, it counts as one operation in flight per light it works on
+    class Admission {
+    public:
+        Admission(::grpc::Status status, std::atomic<uint32_t>* inflight, uint32_t operations = 0)
+            : _status(std::move(status)), _inflight(inflight), _operations(operations) { }
+        ~Admission() { if (_inflight) (*_inflight) -= _operations; }
+
+        Admission(const Admission&) = delete;
+        Admission& operator=(const Admission&) = delete;
+
+        [[nodiscard]] const ::grpc::Status& status() const { return _status; }
+
+    private:
+        ::grpc::Status _status;
+        std::atomic<uint32_t>* _inflight;
+        uint32_t _operations;
     };
-    static std::string expand_with_environment( const std::string &s );
+
+    ElgatoServerImpl();
+    ~ElgatoServerImpl() override;
+
+    void RunServer(const std::string&);
+    // All changes go out as one FixtureUpdate, it is not sent back to originClientId
+    void SendFixtureUpdate(const std::vector<PropertyChange>&, const std::string& originClientId = "");
+    void SendFixtureEvent(const AvahiBrowserEventArgs&);
+
+    ::grpc::Status ListFixtures(::grpc::ServerContext*, const Empty*, FixtureList*) override;
+    ::grpc::Status ListFixturesSince(::grpc::ServerContext*, const FixturesSinceRequest*, FixtureDelta*) override;
+    ::grpc::Status ListFixturesPaged(::grpc::ServerContext*, const ListFixturesRequest*, FixturePage*) override;
+    ::grpc::Status StreamFixtures(::grpc::ServerContext*, const ListFixturesRequest*, ::grpc::ServerWriter<FixturePage>*) override;
+    ::grpc::Status Refresh(::grpc::ServerContext*, const Empty*, SimpleCliResponse*) override;
+
+    ::grpc::Status PowerOn(::grpc::ServerContext*, const SimpleCliRequest*, SimpleCliResponse*) override;
+    ::grpc::Status PowerOff(::grpc::ServerContext*, const SimpleCliRequest*, SimpleCliResponse*) override;
+    ::grpc::Status SetBrightness(::grpc::ServerContext*, const Int32CliRequest*, SimpleCliResponse*) override;
+    ::grpc::Status SetTemperature(::grpc::ServerContext*, const Int32CliRequest*, SimpleCliResponse*) override;
+    ::grpc::Status ApplyBatch(::grpc::ServerContext*, const BatchRequest*, BatchResponse*) override;
+    ::grpc::Status StreamControl(::grpc::ServerContext*, ::grpc::ServerReader<ControlCommand>*, SimpleCliResponse*) override;
+    ::grpc::Status ObserveChanges(::grpc::ServerContext*, const ObserveRequest*, ::grpc::ServerWriter<FixtureUpdate>*) override;
+
+    ::grpc::Status GetStats(::grpc::ServerContext*, const Empty*, DaemonStats*) override;
+
+    // ListFixtures for the async server, hands out the cached bytes without parsing them
+    ::grpc::Status ListFixturesSerialized(::grpc::ServerContext*, const ::grpc::ByteBuffer*, ::grpc::ByteBuffer*);
+
+    // Used by ObserveChanges in both server modes
+    std::shared_ptr<ClientConnection> subscribe(const ObserveRequest&, std::function<void()> onMessage = nullptr);
+    void unsubscribe(const std::string& clientId);
+    // Used by StreamControl in both server modes, never blocks on the light
+    // INVALID_ARGUMENT for a command without a known operation, the stream ends with it
+    ::grpc::Status queueControl(const ControlCommand&, const std::string& clientId);
+    // Used by ListFixturesPaged and StreamFixtures in both server modes: the lights after the page token, ordered by handle
+    static ::grpc::Status pageableLights(const ListFixturesRequest&, std::vector<std::shared_ptr<ElgatoLight>>&);
+    // Fills one page starting at offset and returns the offset of the next one. pageSize replaces a 0 in the request
+    static size_t fillPage(const ListFixturesRequest&, const std::vector<std::shared_ptr<ElgatoLight>>&, size_t offset,
+                           uint32_t pageSize, FixturePage*);
+    static constexpr uint32_t kStreamPageSize = 32;
+    // The ObserveChanges client id a caller sent in its metadata, empty if it didn't
+    static std::string clientIdOf(const ::grpc::ServerContext*);
+    static ::grpc::Status resyncStatus();
+private:
+    // Client reads set fetchMissing, so only lights someone asked for pay for the accessory-info request
+    static void fillFixture(const std::shared_ptr<ElgatoLight>&, Fixture*, bool fetchMissing = true);
+    bool applyOperation(const std::shared_ptr<ElgatoLight>&, FixtureOperation, uint32_t value, LightTraffic, bool force,
+                        std::vector<PropertyChange>&);
+    // Checks the in-flight limit for the operations and then the caller's quota, a refusal carries a retry-after hint
+    // and takes no quota
+    Admission admit(::grpc::ServerContext*, size_t operations);
+    // The traffic class a caller asked for in its metadata, fallback if it didn't
+    static LightTraffic trafficOf(const ::grpc::ServerContext*, LightTraffic fallback);
+    static PropertyChange makeChange(const std::string& fixtureName, uint32_t handle, FixtureProperty, int32_t newValue);
+    void broadcast(const FixtureUpdate&);
+    void updateVersions(const FixtureUpdate&, uint64_t sequence);
+    uint64_t registryVersion();
+    ::grpc::ByteBuffer serializedFixtures();
 
     std::mutex _connectionMutex;
-    std::vector<ClientConnection> _connections;
+    std::vector<std::shared_ptr<ClientConnection>> _connections;
+    UpdateRing _updates;
+
+    // The registry version is the sequence of the last update, removed fixtures are remembered for a while so
+    // ListFixturesSince can report them
+    static constexpr size_t kTombstoneLimit = 256;
+    std::mutex _versionMutex;
+    uint64_t _registryVersion;
+    uint64_t _tombstoneFloor;
+    std::map<std::string, uint64_t> _fixtureVersions;
+    std::map<std::string, uint64_t> _tombstones;
+
+    // The serialized FixtureList, valid as long as neither the registry nor any light state changed
+    std::mutex _fixtureCacheMutex;
+    uint64_t _fixtureCacheVersion = 0;
+    uint64_t _fixtureCacheGeneration = 0;
+    bool _fixtureCacheValid = false;
+    ::grpc::ByteBuffer _fixtureCache;
+
+    // Keyed by client id, or by peer for clients that don't send one. _totalQuota is shared by all of them
+    static constexpr size_t kQuotaLimit = 1024;
+    // An operation takes about one light round trip, so a slot frees up quickly
+    static constexpr std::chrono::milliseconds kOverloadRetryAfter{50};
+    std::mutex _quotaMutex;
+    std::map<std::string, std::shared_ptr<TokenBucket>> _quotas;
+    std::unique_ptr<TokenBucket> _totalQuota;
+    std::atomic<uint32_t> _inflight = 0;
+    std::atomic<uint64_t> _overQuota = 0;
+    std::atomic<uint64_t> _overloaded = 0;
+
+    // Runs the per-light command groups of all batches, so a batch over many lights doesn't start a thread for each
+    WorkerPool _batchWorkers;
+
+    std::unique_ptr<ElgatoAsyncServer> _asyncServer;
 };
\ No newline at end of file
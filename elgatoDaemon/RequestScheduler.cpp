@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "RequestScheduler.h"
+
+#include <algorithm>
+
+std::array<LatencyHistogram, kLightTrafficClasses> RequestScheduler::_queueLatency;
+
+void LatencyHistogram::record(std::chrono::microseconds duration) {
+    auto us = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+    auto bucket = std::lower_bound(kBoundsUs.begin(), kBoundsUs.end(), us) - kBoundsUs.begin();
+
+    _counts[bucket]++;
+    _total++;
+}
+
+RequestScheduler::Slot RequestScheduler::acquire(LightTraffic traffic, std::chrono::steady_clock::time_point enqueued) {
+    auto lane = static_cast<size_t>(traffic);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto ticket = _nextTicket++;
+    _waiting[lane].push_back(ticket);
+
+    _cond.wait(lock, [this, lane, ticket] { return !_busy && isNext(lane, ticket); });
+
+    _waiting[lane].pop_front();
+    _busy = true;
+    lock.unlock();
+
+    _queueLatency[lane].record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - enqueued));
+    return Slot(this);
+}
+
+const LatencyHistogram& RequestScheduler::queueLatency(LightTraffic traffic) {
+    return _queueLatency[static_cast<size_t>(traffic)];
+}
+
+void RequestScheduler::release() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _busy = false;
+    lock.unlock();
+
+    // Only a handful of requests ever wait for one light, they check themselves whose turn it is
+    _cond.notify_all();
+}
+
+bool RequestScheduler::isNext(size_t lane, uint64_t ticket) const {
+    for(size_t higher = 0; higher < lane; higher++) {
+        if (!_waiting[higher].empty()) return false;
+    }
+
+    return _waiting[lane].front() == ticket;
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// Who a request to a light is for, in order of priority. Same order as TrafficClass in the protocol
+enum class LightTraffic { Interactive, Automation, Poll };
+constexpr size_t kLightTrafficClasses = 3;
+
+// Counts durations into fixed buckets, safe to record from any thread
+class LatencyHistogram {
+public:
+    // Upper bounds in microseconds, the last bucket takes everything above
+    static constexpr std::array<uint64_t, 12> kBoundsUs = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000 };
+
+    void record(std::chrono::microseconds duration);
+
+    [[nodiscard]] uint64_t count(size_t bucket) const { return _counts[bucket]; }
+    [[nodiscard]] uint64_t total() const { return _total; }
+
+    static constexpr size_t buckets() { return kBoundsUs.size() + 1; }
+
+private:
+    std::array<std::atomic<uint64_t>, kBoundsUs.size() + 1> _counts = {};
+    std::atomic<uint64_t> _total = 0;
+};
+
+// Lets one request at a time through to a light. Waiting requests go strictly by traffic class and in arrival order
+// within one, so an interactive command only ever waits for the request that is already on the wire.
+class RequestScheduler {
+public:
+    // The turn of one request, the next one is let through when it goes out of scope
+    class Slot {
+    public:
+        explicit Slot(RequestScheduler* scheduler) : _scheduler(scheduler) { }
+        Slot(Slot&& other) noexcept : _scheduler(other._scheduler) { other._scheduler = nullptr; }
+        ~Slot() { if (_scheduler) _scheduler->release(); }
+
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+        Slot& operator=(Slot&&) = delete;
+
+    private:
+        RequestScheduler* _scheduler;
+    };
+
+    // Blocks until it is this request's turn. enqueued is when the request started waiting, earlier than now if it
+    // already waited before it got here
+    Slot acquire(LightTraffic, std::chrono::steady_clock::time_point enqueued = std::chrono::steady_clock::now());
+
+    // Time from enqueued until acquire returned, over all lights
+    static const LatencyHistogram& queueLatency(LightTraffic);
+
+private:
+    void release();
+    bool isNext(size_t lane, uint64_t ticket) const;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    bool _busy = false;
+    uint64_t _nextTicket = 0;
+    std::array<std::deque<uint64_t>, kLightTrafficClasses> _waiting;
+
+    static std::array<LatencyHistogram, kLightTrafficClasses> _queueLatency;
+};
\ No newline at end of file
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+// Smoothed round trip time and its variation, computed like TCP does for its retransmission timeout (RFC 6298)
+class RttEstimator {
+public:
+    void sample(std::chrono::microseconds rtt) {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _backoff = 0;
+
+        if (!_measured) {
+            _srtt = rtt;
+            _rttvar = rtt / 2;
+            _measured = true;
+            return;
+        }
+
+        auto deviation = _srtt > rtt ? _srtt - rtt : rtt - _srtt;
+        _rttvar = (3 * _rttvar + deviation) / 4;
+        _srtt = (7 * _srtt + rtt) / 8;
+    }
+
+    // A request ran into its timeout and produced no sample. Doubles the timeout until the next sample
+    void backoff() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _backoff = std::min(_backoff + 1, kMaxBackoff);
+    }
+
+    // srtt + 4 * rttvar within floor and ceiling, doubled for every timeout since the last sample. The ceiling as long
+    // as there is no sample
+    std::chrono::milliseconds timeout(std::chrono::milliseconds floor, std::chrono::milliseconds ceiling) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ceiling = std::max(floor, ceiling);
+        if (!_measured) return ceiling;
+
+        auto timeout = std::clamp(std::chrono::ceil<std::chrono::milliseconds>(_srtt + 4 * _rttvar), floor, ceiling);
+        return std::min(timeout * (1 << _backoff), ceiling);
+    }
+
+    [[nodiscard]] bool measured() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _measured;
+    }
+
+    [[nodiscard]] std::chrono::microseconds srtt() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _srtt;
+    }
+
+    [[nodiscard]] std::chrono::microseconds rttvar() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _rttvar;
+    }
+
+    // Timeouts since the last sample, up to kMaxBackoff
+    [[nodiscard]] int backoffs() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _backoff;
+    }
+
+private:
+    // Enough to reach any sensible ceiling from the floor
+    static constexpr int kMaxBackoff = 6;
+
+    mutable std::mutex _mutex;
+    bool _measured = false;
+    int _backoff = 0;
+    std::chrono::microseconds _srtt{0};
+    std::chrono::microseconds _rttvar{0};
+};
\ No newline at end of file
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SubnetScanner.h"
+#include "AvahiBrowser.h"
+#include "DaemonConfig.h"
+#include "HTTPRequest.hpp"
+#include "Log.h"
+#include "../Config.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <future>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+void SubnetScanner::start() {
+    const auto& config = DaemonConfig::getInstance();
+    if (config.scanSubnet.empty()) return;
+
+    // Only one sweep at a time, a refresh while sweeping is simply ignored
+    if (!_running.exchange(true)) {
+        std::thread worker(threadStart);
+        worker.detach();
+    }
+
+    if (config.scanIntervalMs == 0 || _scheduled.exchange(true)) return;
+
+    std::thread scheduler([this, intervalMs = config.scanIntervalMs] {
+        while(true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+            start();
+        }
+    });
+    scheduler.detach();
+}
+
+void SubnetScanner::threadStart() {
+    getInstance().sweepNow();
+    getInstance()._running = false;
+}
+
+void SubnetScanner::sweepNow() {
+    const auto& config = DaemonConfig::getInstance();
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::clog << kLogNotice << "(SubnetScanner) Sweeping " << config.scanSubnet << " for port " << config.scanPort << std::endl;
+
+    auto hits = sweep(config.scanSubnet, config.scanPort, config.scanConcurrency, config.scanTimeoutMs);
+
+    std::vector<std::future<std::string>> confirmations;
+    for(const auto& address : hits) {
+        confirmations.push_back(std::async(std::launch::async, confirm, address, config.scanPort, config.scanTimeoutMs * 4));
+    }
+
+    std::set<std::string> swept;
+    for(auto& confirmation : confirmations) {
+        auto name = confirmation.get();
+        if (!name.empty()) swept.insert(name);
+    }
+
+    std::unique_lock<std::mutex> lock(_sweptMutex);
+    for(const auto& name : _swept) {
+        if (swept.count(name) == 0) {
+            std::clog << kLogInfo << "(SubnetScanner) " << name << " no longer answers." << std::endl;
+            AvahiBrowser::getInstance().removePath(name, kSweptInterface);
+        }
+    }
+
+    _swept = swept;
+    lock.unlock();
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+    std::clog << kLogNotice << "(SubnetScanner) Sweep finished in " << duration.count() << "ms, " << hits.size() << " host(s) answered." << std::endl;
+}
+
+bool SubnetScanner::parseCidr(const std::string& cidr, uint32_t& firstHost, uint32_t& lastHost) {
+    auto slash = cidr.find('/');
+    auto addressPart = cidr.substr(0, slash);
+    int prefix = 32;
+
+    if (slash != std::string::npos) {
+        char* end = nullptr;
+        prefix = (int)strtol(cidr.c_str() + slash + 1, &end, 10);
+        if (end == cidr.c_str() + slash + 1 || *end != '\0' || prefix < 0 || prefix > 32)
+            return false;
+    }
+
+    in_addr address = {};
+    if (inet_pton(AF_INET, addressPart.c_str(), &address) != 1)
+        return false;
+
+    uint32_t mask = prefix == 0 ? 0 : 0xFFFFFFFFu << (32 - prefix);
+    uint32_t network = ntohl(address.s_addr) & mask;
+
+    firstHost = network;
+    lastHost = network | ~mask;
+
+    // Skip network and broadcast address, /31 and /32 have none
+    if (prefix < 31) {
+        firstHost++;
+        lastHost--;
+    }
+
+    return true;
+}
+
+std::vector<std::string> SubnetScanner::sweep(const std::string& cidr, uint16_t port, uint16_t concurrency, uint32_t timeoutMs) {
+    struct PendingConnect {
+        int socket;
+        uint32_t host;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    std::vector<std::string> hits;
+    uint32_t firstHost, lastHost;
+
+    if (!parseCidr(cidr, firstHost, lastHost)) {
+        std::clog << kLogErr << "(SubnetScanner) Invalid subnet '" << cidr << "'" << std::endl;
+        return hits;
+    }
+
+    if (concurrency == 0) concurrency = 1;
+
+    const auto addHit = [&hits](uint32_t host) {
+        char strAddress[INET_ADDRSTRLEN];
+        in_addr address = { htonl(host) };
+        inet_ntop(AF_INET, &address, strAddress, sizeof(strAddress));
+        hits.emplace_back(strAddress);
+    };
+
+    std::vector<PendingConnect> inFlight;
+    std::vector<pollfd> pollFds;
+    uint64_t nextHost = firstHost;
+
+    while(nextHost <= lastHost || !inFlight.empty()) {
+        // Keep the window filled
+        while(inFlight.size() < concurrency && nextHost <= lastHost) {
+            auto host = (uint32_t)nextHost++;
+            int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (sock < 0) {
+                std::clog << kLogErr << "(SubnetScanner) Failed to create socket: " << strerror(errno) << std::endl;
+                break;
+            }
+
+            sockaddr_in target = {};
+            target.sin_family = AF_INET;
+            target.sin_port = htons(port);
+            target.sin_addr.s_addr = htonl(host);
+
+            if (connect(sock, (sockaddr*)&target, sizeof(target)) == 0) {
+                addHit(host);
+                close(sock);
+            } else if (errno == EINPROGRESS) {
+                inFlight.push_back({sock, host, std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs)});
+            } else {
+                close(sock);
+            }
+        }
+
+        if (inFlight.empty()) continue;
+
+        auto now = std::chrono::steady_clock::now();
+        auto nearestDeadline = inFlight.front().deadline;
+        pollFds.clear();
+
+        for(const auto& pending : inFlight) {
+            pollFds.push_back({pending.socket, POLLOUT, 0});
+            if (pending.deadline < nearestDeadline) nearestDeadline = pending.deadline;
+        }
+
+        auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(nearestDeadline - now).count();
+        if (poll(pollFds.data(), pollFds.size(), waitMs > 0 ? (int)waitMs : 0) < 0 && errno != EINTR) {
+            std::clog << kLogErr << "(SubnetScanner) poll failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        now = std::chrono::steady_clock::now();
+        std::vector<PendingConnect> stillPending;
+
+        for(size_t i = 0; i < inFlight.size(); i++) {
+            const auto& pending = inFlight[i];
+
+            if (pollFds[i].revents & (POLLOUT | POLLERR | POLLHUP)) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if (getsockopt(pending.socket, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0)
+                    addHit(pending.host);
+
+                close(pending.socket);
+            } else if (now >= pending.deadline) {
+                close(pending.socket);
+            } else {
+                stillPending.push_back(pending);
+            }
+        }
+
+        inFlight.swap(stillPending);
+    }
+
+    for(const auto& pending : inFlight) {
+        close(pending.socket);
+    }
+
+    return hits;
+}
+
+std::string SubnetScanner::confirm(const std::string& address, uint16_t port, uint32_t timeoutMs) {
+    try {
+        auto requestString = fmt::format("http://{}:{}/elgato/accessory-info", address, port);
+
+        http::Request request{requestString};
+        const auto response = request.send("GET", "", {}, std::chrono::milliseconds(timeoutMs));
+        if (response.status.code != 200) return {};
+
+        const auto resString = std::string{response.body.begin(), response.body.end()};
+        auto info = std::make_shared<ElgatoAccessoryInfo>(json::parse(resString).get<ElgatoAccessoryInfo>());
+
+        // There is no mDNS service name for swept lights, so build a stable one from the accessory info
+        auto name = fmt::format("{} {}", info->productName, info->serialNumber);
+        auto& browser = AvahiBrowser::getInstance();
+
+        // Found before, possibly at another address after a new DHCP lease
+        if (browser.absorbIfKnown(name, "", address.c_str(), port, kSweptInterface))
+            return name;
+
+        auto light = std::make_shared<ElgatoLight>(name, address.c_str(), port, info, true, kSweptInterface);
+
+#if DEBUG_BUILD
+        std::clog << kLogDebug << "(SubnetScanner) Confirmed " << light->name() << " at " << address << std::endl;
+#endif
+
+        return browser.addIfUnknown(light) ? name : std::string();
+    } catch (const std::exception& e) {
+#if DEBUG_BUILD
+        std::clog << kLogDebug << "(SubnetScanner) " << address << " is not an Elgato light: " << e.what() << std::endl;
+#endif
+        return {};
+    }
+}
\ No newline at end of file
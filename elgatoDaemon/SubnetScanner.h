@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class SubnetScanner final {
+public:
+    static SubnetScanner& getInstance() {
+        static SubnetScanner instance;
+        return instance;
+    }
+
+    SubnetScanner(const SubnetScanner&) = delete;
+    SubnetScanner& operator=(const SubnetScanner&) = delete;
+
+    // Sweeps the configured subnet in the background and again every scanIntervalMs, does nothing if no subnet is
+    // configured
+    void start();
+    // One sweep of the configured subnet in the calling thread. Swept lights that no longer answer are handed to the
+    // AvahiBrowser as lost, which drops them after the grace period
+    void sweepNow();
+
+    // Returns every address inside cidr that accepts a TCP connection on port
+    static std::vector<std::string> sweep(const std::string& cidr, uint16_t port, uint16_t concurrency, uint32_t timeoutMs);
+
+    static bool parseCidr(const std::string& cidr, uint32_t& firstHost, uint32_t& lastHost);
+
+    // Registers the light at address, or moves the known light of the same name there. Returns its name, empty if
+    // there is no Elgato light or mDNS knows it under another name
+    static std::string confirm(const std::string& address, uint16_t port, uint32_t timeoutMs);
+
+private:
+    SubnetScanner() = default;
+
+    // Swept lights have no mDNS interface, their one path uses this index
+    static constexpr int kSweptInterface = -1;
+
+    static void threadStart();
+
+    std::atomic<bool> _running = false;
+    std::atomic<bool> _scheduled = false;
+
+    // Names of the lights the last sweep found
+    std::mutex _sweptMutex;
+    std::set<std::string> _swept = {};
+};
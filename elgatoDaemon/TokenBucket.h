@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+// Refills at rate tokens per second up to burst, every request takes one
+class TokenBucket {
+public:
+    TokenBucket(double rate, double burst)
+        : _rate(rate), _burst(std::max(burst, 1.0)), _tokens(_burst), _last(std::chrono::steady_clock::now()) { }
+
+    // Takes a token if there is one, otherwise wait is set to the time until there is
+    bool tryTake(std::chrono::microseconds& wait) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        refill();
+
+        if (_tokens >= 1.0) {
+            _tokens -= 1.0;
+            wait = std::chrono::microseconds(0);
+            return true;
+        }
+
+        wait = std::chrono::microseconds(static_cast<int64_t>((1.0 - _tokens) / _rate * 1e6) + 1);
+        return false;
+    }
+
+    // Puts back a token taken for a request that was refused for another reason
+    void refund() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tokens = std::min(_burst, _tokens + 1.0);
+    }
+
+    // A full bucket has not been used for a while and can be dropped
+    bool isFull() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        refill();
+        return _tokens >= _burst;
+    }
+
+private:
+    void refill() {
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration<double>(now - _last).count();
+
+        _tokens = std::min(_burst, _tokens + elapsed * _rate);
+        _last = now;
+    }
+
+    std::mutex _mutex;
+    double _rate;
+    double _burst;
+    double _tokens;
+    std::chrono::steady_clock::time_point _last;
+};
\ No newline at end of file
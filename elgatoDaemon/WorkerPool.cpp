@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+
+#include "WorkerPool.h"
+#include "Log.h"
+
+WorkerPool::WorkerPool(size_t threads) {
+    if (threads == 0) threads = 1;
+
+    for(size_t i = 0; i < threads; i++) {
+        _threads.emplace_back(&WorkerPool::work, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stopping = true;
+    lock.unlock();
+    _cond.notify_all();
+
+    for(auto& thread : _threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::submit(std::function<void()> job) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _jobs.push_back(std::move(job));
+    lock.unlock();
+
+    _cond.notify_one();
+}
+
+void WorkerPool::work() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while(true) {
+        _cond.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+        if (_jobs.empty()) return;
+
+        auto job = std::move(_jobs.front());
+        _jobs.pop_front();
+        lock.unlock();
+
+        // A throwing job must not take the worker, or the daemon, down with it
+        try {
+            job();
+        } catch (const std::exception& e) {
+            std::clog << kLogErr << "Worker job failed: " << e.what() << std::endl;
+        } catch (...) {
+            std::clog << kLogErr << "Worker job failed" << std::endl;
+        }
+
+        lock.lock();
+    }
+}
\ No newline at end of file
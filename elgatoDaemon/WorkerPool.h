@@ -26,63 +26,31 @@
 
 #pragma once
 
-#include <queue>
-#include <mutex>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-template <typename T>
-class SharedQueue {
+// A fixed set of threads running jobs in the order they were submitted
+class WorkerPool {
 public:
-    SharedQueue() { };
-    ~SharedQueue() { };
-
-    T& front() {
-        std::unique_lock<std::mutex> mlock(_mutex);
-        while(_queue.empty())
-        {
-            _cond.wait(mlock);
-        }
-
-        return _queue.front();
-    };
-
-    void pop_front() {
-        std::unique_lock<std::mutex> mlock(_mutex);
-        while(_queue.empty()) {
-            _cond.wait(mlock);
-        }
+    explicit WorkerPool(size_t threads);
+    // Runs the jobs still queued before it returns
+    ~WorkerPool();
 
-        _queue.pop_front();
-    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
 
-    void push_back(const T& item) {
-        std::unique_lock<std::mutex> mlock(_mutex);
-        _queue.push_back(item);
-        mlock.unlock();
-        _cond.notify_one();
-    }
-
-    void push_back(T&& item) {
-        std::unique_lock<std::mutex> mlock(_mutex);
-        _queue.push_back(std::move(item));
-        mlock.unlock();
-        _cond.notify_one();
-    }
-
-    int size() {
-          std::unique_lock<std::mutex> mlock(_mutex);
-          auto size = _queue.size();
-          mlock.unlock();
-
-          return size;
-    }
-
-    bool empty() {
-        return size() == 0;
-    }
+    void submit(std::function<void()> job);
 
 private:
-    std::deque<T> _queue;
+    void work();
+
     std::mutex _mutex;
     std::condition_variable _cond;
+    std::deque<std::function<void()>> _jobs;
+    bool _stopping = false;
+    std::vector<std::thread> _threads;
 };
\ No newline at end of file
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Publish cost of the update ring against the fan-out it replaced, a detached thread per update copying it into one
+// locked queue per subscriber. Build with -DBUILD_BENCHMARKS=ON, run without arguments.
+
+#include "../BroadcastRing.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Update {
+    std::string fixtureName;
+    std::string property;
+    std::string clientId;
+    int newValue;
+};
+
+// What every subscriber had before the ring
+class LockedQueue {
+public:
+    void push_back(const Update& update) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _queue.push_back(update);
+        lock.unlock();
+        _cond.notify_one();
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _queue.size();
+    }
+
+private:
+    std::deque<Update> _queue;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+};
+
+constexpr int kPublishes = 20000;
+
+double nsPerPublish(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration<double, std::nano>(end - start).count() / kPublishes;
+}
+
+}
+
+int main() {
+    const Update update = { "Elgato Key Light Air 1A2B", "Brightness", "", 42 };
+
+    for(int subscribers : { 1, 4, 16, 64 }) {
+        std::mutex connectionMutex;
+
+        std::vector<std::shared_ptr<LockedQueue>> queues;
+        for(int i = 0; i < subscribers; i++) {
+            queues.push_back(std::make_shared<LockedQueue>());
+        }
+
+        auto queueStart = std::chrono::steady_clock::now();
+        for(int i = 0; i < kPublishes; i++) {
+            std::thread caller([&connectionMutex, &queues, update] {
+                std::lock_guard<std::mutex> lock(connectionMutex);
+                for(auto& queue : queues) {
+                    queue->push_back(update);
+                }
+            });
+            caller.detach();
+        }
+        auto queuePublished = std::chrono::steady_clock::now();
+
+        auto delivered = [&queues] {
+            for(auto& queue : queues) {
+                if (queue->size() < kPublishes) return false;
+            }
+            return true;
+        };
+        while(!delivered()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        auto queueDelivered = std::chrono::steady_clock::now();
+
+        // Publishing into the ring and waking every parked stream, which is all the daemon does per update now
+        BroadcastRing<std::shared_ptr<const Update>> ring(1024);
+        std::atomic<int> woken = 0;
+        std::vector<std::function<void()>> notify(subscribers, [&woken] { woken++; });
+
+        auto ringStart = std::chrono::steady_clock::now();
+        for(int i = 0; i < kPublishes; i++) {
+            ring.publish(std::make_shared<const Update>(update));
+
+            std::lock_guard<std::mutex> lock(connectionMutex);
+            for(auto& wake : notify) {
+                wake();
+            }
+        }
+        auto ringPublished = std::chrono::steady_clock::now();
+
+        std::printf("%3d subscriber(s): thread + queue copy %8.0f ns (delivered after %8.0f ns), ring %6.0f ns\n", subscribers,
+                    nsPerPublish(queueStart, queuePublished), nsPerPublish(queueStart, queueDelivered),
+                    nsPerPublish(ringStart, ringPublished));
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Sequence numbers, wraparound and overrun of the update ring every ObserveChanges stream reads from
+
+#include "../BroadcastRing.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    std::cout << (condition ? "ok   " : "FAIL ") << what << std::endl;
+    if (!condition) failures++;
+}
+
+}
+
+int main() {
+    using Ring = BroadcastRing<int>;
+
+    {
+        Ring ring(4, 100);
+        int item = 0;
+        uint64_t cursor = ring.head();
+
+        check(ring.head() == 99 && ring.oldest() == 100, "an empty ring starts before firstSequence");
+        check(ring.read(cursor, item) == Ring::ReadResult::Empty, "an empty ring has nothing to read");
+        check(ring.publish(1) == 100 && ring.publish(2) == 101, "publish hands out consecutive sequence numbers");
+        check(ring.read(cursor, item) == Ring::ReadResult::Ok && item == 1 && cursor == 100, "read returns the first item");
+        check(ring.read(cursor, item) == Ring::ReadResult::Ok && item == 2 && cursor == 101, "read advances the cursor");
+        check(ring.read(cursor, item) == Ring::ReadResult::Empty && cursor == 101, "a caught up reader gets Empty");
+    }
+
+    {
+        Ring ring(4);
+        uint64_t slow = ring.head();
+        uint64_t resumed = 2;
+        int item = 0;
+
+        for(int i = 1; i <= 10; i++) {
+            ring.publish(i);
+        }
+
+        check(ring.head() == 10 && ring.oldest() == 7, "a full ring keeps the last capacity items");
+        check(ring.read(slow, item) == Ring::ReadResult::Overrun && slow == 0, "a reader behind oldest gets Overrun and keeps its cursor");
+        check(ring.read(resumed, item) == Ring::ReadResult::Overrun, "resuming after an evicted sequence is an overrun");
+
+        uint64_t cursor = ring.oldest() - 1;
+        std::string seen;
+        while(ring.read(cursor, item) == Ring::ReadResult::Ok) {
+            seen += std::to_string(item) + " ";
+        }
+        check(seen == "7 8 9 10 ", "the items after wraparound come out in order");
+
+        uint64_t lastKept = 6;
+        check(ring.read(lastKept, item) == Ring::ReadResult::Ok && item == 7, "resuming right before oldest replays everything kept");
+    }
+
+    {
+        Ring ring(2);
+        ring.publishWith([](uint64_t sequence) { return static_cast<int>(sequence) * 10; });
+        uint64_t cursor = 0;
+        int item = 0;
+
+        check(ring.read(cursor, item) == Ring::ReadResult::Ok && item == 10, "publishWith builds the item from its sequence");
+        check(!ring.waitFor(cursor, std::chrono::milliseconds(1)), "waitFor times out without a new item");
+        ring.publish(3);
+        check(ring.waitFor(cursor, std::chrono::milliseconds(1)), "waitFor returns once something was published");
+    }
+
+    {
+        Ring ring(0);
+        ring.publish(1);
+        ring.publish(2);
+        uint64_t cursor = 0;
+        int item = 0;
+
+        check(ring.capacity() == 1 && ring.read(cursor, item) == Ring::ReadResult::Overrun,
+              "a ring asked for no capacity keeps a single item");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// ListFixturesSince answers from its tombstones until a client is older than the oldest one it dropped, then with
+// everything
+
+#include "../ElgatoServerImpl.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// ElgatoServerImpl::kTombstoneLimit
+constexpr int kTombstones = 256;
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    std::cout << (condition ? "ok   " : "FAIL ") << what << std::endl;
+    if (!condition) failures++;
+}
+
+FixtureDelta since(ElgatoServerImpl& server, uint64_t version) {
+    FixturesSinceRequest request;
+    request.set_version(version);
+
+    FixtureDelta delta;
+    server.ListFixturesSince(nullptr, &request, &delta);
+    return delta;
+}
+
+uint64_t remove(ElgatoServerImpl& server, const std::string& name) {
+    server.SendFixtureEvent({AvahiBrowserEventType::LIGHT_REMOVED, name});
+    return since(server, 0).version();
+}
+
+}
+
+int main() {
+    ElgatoServerImpl server;
+
+    auto start = since(server, 0);
+    check(start.full(), "version 0 gets everything");
+    check(since(server, start.version()).notmodified(), "the current version is not modified");
+
+    auto first = remove(server, "gone-0");
+    auto delta = since(server, start.version());
+    check(!delta.full() && delta.removed_size() == 1 && delta.removed(0) == "gone-0", "a removal shows up as a tombstone");
+    check(delta.version() == first, "the delta carries the new version");
+    check(since(server, first + 1).full(), "a version from the future gets everything");
+
+    std::vector<uint64_t> versions = { first };
+    for(int i = 1; i <= kTombstones; i++) {
+        versions.push_back(remove(server, "gone-" + std::to_string(i)));
+    }
+
+    // One more tombstone than kept, so gone-0 was dropped and its version is the floor
+    check(since(server, start.version()).full(), "a client older than the dropped tombstone gets everything");
+
+    delta = since(server, versions[0]);
+    check(!delta.full() && delta.removed_size() == kTombstones, "a client at the floor still gets a delta");
+
+    delta = since(server, versions[kTombstones - 1]);
+    check(!delta.full() && delta.removed_size() == 1 && delta.removed(0) == "gone-" + std::to_string(kTombstones),
+          "a recent client only gets the newest removal");
+
+    check(since(server, versions.back()).notmodified(), "the last removal is the current version");
+
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Order in which RequestScheduler lets waiting requests through to a light, and the queue latency histogram
+
+#include "../RequestScheduler.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    std::cout << (condition ? "ok   " : "FAIL ") << what << std::endl;
+    if (!condition) failures++;
+}
+
+}
+
+int main() {
+    {
+        RequestScheduler scheduler;
+        std::mutex orderMutex;
+        std::string order;
+        std::vector<std::thread> waiters;
+
+        auto busy = std::make_unique<RequestScheduler::Slot>(scheduler.acquire(LightTraffic::Poll));
+
+        // Queue behind the busy slot in reverse priority, interactive ones last and in arrival order
+        std::vector<std::pair<LightTraffic, char>> requests = {
+            { LightTraffic::Poll, 'p' }, { LightTraffic::Automation, 'a' }, { LightTraffic::Poll, 'q' },
+            { LightTraffic::Interactive, 'i' }, { LightTraffic::Automation, 'b' }, { LightTraffic::Interactive, 'j' } };
+
+        for(auto& [traffic, name] : requests) {
+            waiters.emplace_back([&scheduler, &orderMutex, &order, traffic = traffic, name = name] {
+                auto slot = scheduler.acquire(traffic);
+                std::lock_guard<std::mutex> lock(orderMutex);
+                order += name;
+            });
+
+            // Nothing tells from outside that a request is queued, give it time to get there
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+
+        check(order.empty(), "nothing passes a busy slot");
+
+        busy.reset();
+        for(auto& waiter : waiters) {
+            waiter.join();
+        }
+
+        check(order == "ijabpq", "waiting requests go by traffic class, then by arrival (got " + order + ")");
+    }
+
+    {
+        RequestScheduler scheduler;
+        auto& latency = RequestScheduler::queueLatency(LightTraffic::Automation);
+
+        // The histogram is shared by all schedulers, count how many took 10ms or more so far
+        auto slow = [&latency] {
+            uint64_t count = 0;
+            for(size_t bucket = 6; bucket < LatencyHistogram::buckets(); bucket++) count += latency.count(bucket);
+            return count;
+        };
+        auto before = latency.total();
+        auto slowBefore = slow();
+        auto enqueued = std::chrono::steady_clock::now() - std::chrono::milliseconds(20);
+
+        {
+            auto slot = scheduler.acquire(LightTraffic::Automation, enqueued);
+        }
+        auto slot = scheduler.acquire(LightTraffic::Automation);
+
+        check(latency.total() == before + 2, "every acquire records its queue latency");
+        check(slow() == slowBefore + 1, "the latency counts from enqueued, not from the call");
+    }
+
+    {
+        LatencyHistogram histogram;
+        histogram.record(std::chrono::microseconds(-5));
+        histogram.record(std::chrono::microseconds(100));
+        histogram.record(std::chrono::microseconds(101));
+        histogram.record(std::chrono::seconds(5));
+
+        check(histogram.count(0) == 2, "negative durations and the bound itself go to the first bucket");
+        check(histogram.count(1) == 1, "just above a bound goes to the next bucket");
+        check(histogram.count(LatencyHistogram::buckets() - 1) == 1, "the last bucket takes everything above");
+        check(histogram.total() == 4, "total counts every record");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
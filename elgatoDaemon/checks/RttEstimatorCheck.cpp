@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Smoothing, clamping and backoff of the per-light request timeout
+
+#include "../RttEstimator.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    std::cout << (condition ? "ok   " : "FAIL ") << what << std::endl;
+    if (!condition) failures++;
+}
+
+}
+
+int main() {
+    using namespace std::chrono_literals;
+
+    {
+        RttEstimator rtt;
+
+        check(!rtt.measured() && rtt.timeout(50ms, 2000ms) == 2000ms, "without a sample the timeout is the ceiling");
+        check(rtt.timeout(50ms, 10ms) == 50ms, "a ceiling below the floor is raised to it");
+
+        rtt.sample(100ms);
+        check(rtt.measured() && rtt.srtt() == 100ms && rtt.rttvar() == 50ms, "the first sample sets srtt and half of it as rttvar");
+        check(rtt.timeout(50ms, 2000ms) == 300ms, "the timeout is srtt + 4 * rttvar");
+
+        rtt.sample(200ms);
+        check(rtt.srtt() == 112500us && rtt.rttvar() == 62500us, "later samples are smoothed like RFC 6298");
+        check(rtt.timeout(50ms, 200ms) == 200ms, "the timeout is clamped to the ceiling");
+    }
+
+    {
+        RttEstimator rtt;
+        rtt.sample(1ms);
+        check(rtt.timeout(50ms, 2000ms) == 50ms, "the timeout is clamped to the floor");
+    }
+
+    {
+        RttEstimator rtt;
+        rtt.sample(100ms);
+
+        rtt.backoff();
+        check(rtt.backoffs() == 1 && rtt.timeout(50ms, 2000ms) == 600ms, "a backoff doubles the timeout");
+        rtt.backoff();
+        check(rtt.timeout(50ms, 2000ms) == 1200ms, "every backoff doubles it again");
+        rtt.backoff();
+        check(rtt.timeout(50ms, 2000ms) == 2000ms, "a backed off timeout stays below the ceiling");
+
+        for(int i = 0; i < 20; i++) {
+            rtt.backoff();
+        }
+        check(rtt.backoffs() == 6, "backoffs stop counting at kMaxBackoff");
+        check(rtt.timeout(1ms, 1h) == 19200ms, "the longest backoff is 64 times the timeout");
+
+        rtt.sample(100ms);
+        check(rtt.backoffs() == 0 && rtt.timeout(50ms, 2000ms) < 600ms, "a sample resets the backoff");
+    }
+
+    {
+        RttEstimator rtt;
+        rtt.backoff();
+        check(rtt.timeout(50ms, 2000ms) == 2000ms, "a backoff without a sample keeps the ceiling");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
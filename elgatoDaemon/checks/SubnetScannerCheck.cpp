@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Runs the subnet sweep against a fake light on the loopback interface: finds it, follows it to a new address and
+// drops it once it stops answering. Needs 127.0.0.2 to be routed to lo, which Linux does by default.
+
+#include "../AvahiBrowser.h"
+#include "../DaemonConfig.h"
+#include "../Log.h"
+#include "../SubnetScanner.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// Answers accessory-info and the light state like a Key Light does, one request per connection
+class FakeLight {
+public:
+    FakeLight(const char* address, uint16_t port) {
+        _socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_port = htons(port);
+        inet_pton(AF_INET, address, &local.sin_addr);
+
+        if (bind(_socket, (sockaddr*)&local, sizeof(local)) != 0 || listen(_socket, 16) != 0) {
+            std::cerr << "Can't listen on " << address << ":" << port << ": " << strerror(errno) << std::endl;
+            return;
+        }
+
+        socklen_t length = sizeof(local);
+        getsockname(_socket, (sockaddr*)&local, &length);
+        _port = ntohs(local.sin_port);
+
+        _thread = std::thread(&FakeLight::serve, this);
+    }
+
+    ~FakeLight() {
+        _stopping = true;
+        if (_thread.joinable()) _thread.join();
+        close(_socket);
+    }
+
+    FakeLight(const FakeLight&) = delete;
+    FakeLight& operator=(const FakeLight&) = delete;
+
+    [[nodiscard]] uint16_t port() const { return _port; }
+
+private:
+    void serve() {
+        while(!_stopping) {
+            pollfd pollFd = { _socket, POLLIN, 0 };
+            if (poll(&pollFd, 1, 50) != 1) continue;
+
+            int connection = accept4(_socket, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection < 0) continue;
+
+            answer(connection);
+            close(connection);
+        }
+    }
+
+    static void answer(int connection) {
+        std::string request;
+        char buffer[1024];
+
+        // The sweep only connects and closes again
+        while(request.find("\r\n\r\n") == std::string::npos) {
+            pollfd pollFd = { connection, POLLIN, 0 };
+            if (poll(&pollFd, 1, 1000) != 1) return;
+
+            auto received = recv(connection, buffer, sizeof(buffer), 0);
+            if (received <= 0) return;
+            request.append(buffer, received);
+        }
+
+        std::string body;
+        if (request.rfind("GET /elgato/accessory-info ", 0) == 0)
+            body = R"({"productName":"Elgato Key Light","hardwareBoardType":53,"firmwareBuildNumber":218,)"
+                   R"("firmwareVersion":"1.0.3","serialNumber":"CHECK0001","displayName":"Check"})";
+        else if (request.rfind("GET /elgato/lights ", 0) == 0)
+            body = R"({"numberOfLights":1,"lights":[{"on":1,"brightness":20,"temperature":213}]})";
+
+        auto response = (body.empty() ? std::string("HTTP/1.1 404 Not Found\r\n") : std::string("HTTP/1.1 200 OK\r\n")) +
+                        "Content-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) +
+                        "\r\nConnection: close\r\n\r\n" + body;
+        send(connection, response.data(), response.size(), MSG_NOSIGNAL);
+    }
+
+    int _socket = -1;
+    uint16_t _port = 0;
+    std::atomic<bool> _stopping = false;
+    std::thread _thread;
+};
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    std::cout << (condition ? "ok   " : "FAIL ") << what << std::endl;
+    if (!condition) failures++;
+}
+
+}
+
+int main() {
+    std::clog.rdbuf(new Log("subnetScannerCheck", LOG_USER));
+
+    uint32_t first = 0, last = 0;
+    check(SubnetScanner::parseCidr("192.168.1.0/24", first, last) && first == 0xC0A80101 && last == 0xC0A801FE,
+          "parseCidr skips network and broadcast address");
+    check(SubnetScanner::parseCidr("10.0.0.6/31", first, last) && first == 0x0A000006 && last == 0x0A000007,
+          "parseCidr keeps both addresses of a /31");
+    check(SubnetScanner::parseCidr("10.0.0.7", first, last) && first == 0x0A000007 && last == 0x0A000007,
+          "parseCidr takes a single address");
+    check(!SubnetScanner::parseCidr("10.0.0.0/33", first, last), "parseCidr rejects a prefix above 32");
+    check(!SubnetScanner::parseCidr("10.0.0.0/", first, last), "parseCidr rejects an empty prefix");
+    check(!SubnetScanner::parseCidr("light/24", first, last), "parseCidr rejects a name");
+
+    auto& config = DaemonConfig::getInstance();
+    auto& browser = AvahiBrowser::getInstance();
+    config.scanSubnet = "127.0.0.0/30";
+    config.scanIntervalMs = 0;
+    config.discoveryGraceMs = 0;
+
+    uint16_t port;
+    {
+        FakeLight light("127.0.0.1", 0);
+        port = light.port();
+        config.scanPort = port;
+
+        check(SubnetScanner::sweep(config.scanSubnet, port, 4, 300) == std::vector<std::string>{ "127.0.0.1" },
+              "sweep finds the fake light and nothing else");
+        check(SubnetScanner::confirm("127.0.0.1", port + 1, 300).empty(), "confirm ignores a host without a light");
+
+        SubnetScanner::getInstance().sweepNow();
+        auto lights = browser.getLights();
+        check(lights.size() == 1 && lights.front()->name() == "Elgato Key Light CHECK0001", "sweep registers the light");
+        check(!lights.empty() && lights.front()->isReady(), "the swept light is ready");
+        check(!lights.empty() && lights.front()->portString() == "127.0.0.1:" + std::to_string(port),
+              "the swept light uses the address it was found at");
+    }
+
+    {
+        FakeLight moved("127.0.0.2", port);
+
+        SubnetScanner::getInstance().sweepNow();
+        auto lights = browser.getLights();
+        check(lights.size() == 1 && lights.front()->portString() == "127.0.0.2:" + std::to_string(port),
+              "a light at a new address is moved there");
+    }
+
+    SubnetScanner::getInstance().sweepNow();
+    check(browser.getLights().empty(), "a light that stopped answering is dropped");
+
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// What a subscriber that lags more than its capacity behind gets under each backpressure policy
+
+#include "../ElgatoServerImpl.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    std::cout << (condition ? "ok   " : "FAIL ") << what << std::endl;
+    if (!condition) failures++;
+}
+
+void publish(ElgatoServerImpl::UpdateRing& ring, const std::string& fixtureName, FixtureProperty property, int32_t value) {
+    auto update = std::make_shared<FixtureUpdate>();
+    update->set_eventtype(PROPERTY_CHANGED);
+    auto change = update->add_changes();
+    change->set_fixturename(fixtureName);
+    change->set_property(property);
+    change->set_newvalue(value);
+
+    ring.publishWith([&update](uint64_t sequence) {
+        update->set_sequence(sequence);
+        return std::shared_ptr<const FixtureUpdate>(update);
+    });
+}
+
+// "name:value" of every change the subscriber gets right now
+std::string drain(ElgatoServerImpl::ClientConnection& connection) {
+    std::string received;
+    std::shared_ptr<const FixtureUpdate> message;
+
+    while(connection.tryGetMessage(message)) {
+        for(auto& change : message->changes()) {
+            received += change.fixturename() + ":" + std::to_string(change.newvalue()) + " ";
+        }
+    }
+
+    return received;
+}
+
+uint64_t dropped(const ElgatoServerImpl::ClientConnection& connection) {
+    SubscriberStats stats;
+    connection.fillStats(&stats);
+    return stats.dropped();
+}
+
+}
+
+int main() {
+    {
+        ElgatoServerImpl::UpdateRing ring(16);
+        ElgatoServerImpl::ClientConnection connection("check", ring, DROP_OLDEST, 4, ring.head(), false);
+
+        for(int i = 1; i <= 3; i++) {
+            publish(ring, "a", BRIGHTNESS, i);
+        }
+
+        check(drain(connection) == "a:1 a:2 a:3 ", "a subscriber within its capacity gets every update");
+        check(dropped(connection) == 0, "nothing is dropped within capacity");
+    }
+
+    {
+        ElgatoServerImpl::UpdateRing ring(16);
+        ElgatoServerImpl::ClientConnection connection("check", ring, DROP_OLDEST, 2, ring.head(), false);
+
+        for(int i = 1; i <= 5; i++) {
+            publish(ring, "a", BRIGHTNESS, i);
+        }
+
+        check(drain(connection) == "a:4 a:5 ", "DROP_OLDEST keeps the newest capacity updates");
+        check(dropped(connection) == 3, "DROP_OLDEST counts what it skipped");
+        check(!connection.resyncRequired(), "DROP_OLDEST keeps the stream open");
+    }
+
+    {
+        ElgatoServerImpl::UpdateRing ring(16);
+        ElgatoServerImpl::ClientConnection connection("check", ring, COALESCE, 2, ring.head(), false);
+
+        publish(ring, "a", BRIGHTNESS, 1);
+        publish(ring, "b", BRIGHTNESS, 10);
+        publish(ring, "a", BRIGHTNESS, 2);
+        publish(ring, "a", TEMPERATURE, 5000);
+        publish(ring, "a", BRIGHTNESS, 3);
+
+        check(drain(connection) == "b:10 a:5000 a:3 ", "COALESCE keeps the latest value per fixture and property, in order");
+        check(dropped(connection) == 2, "COALESCE counts the values it replaced");
+    }
+
+    {
+        ElgatoServerImpl::UpdateRing ring(4);
+        ElgatoServerImpl::ClientConnection connection("check", ring, COALESCE, 2, ring.head(), false);
+
+        for(int i = 1; i <= 8; i++) {
+            publish(ring, i % 2 ? "a" : "b", BRIGHTNESS, i);
+        }
+
+        check(drain(connection) == "a:7 b:8 ", "COALESCE still ends at the latest values after the ring wrapped");
+    }
+
+    {
+        ElgatoServerImpl::UpdateRing ring(16);
+        ElgatoServerImpl::ClientConnection connection("check", ring, DISCONNECT, 2, ring.head(), false);
+
+        for(int i = 1; i <= 3; i++) {
+            publish(ring, "a", BRIGHTNESS, i);
+        }
+
+        check(drain(connection).empty(), "DISCONNECT sends nothing once the subscriber fell behind");
+        check(connection.resyncRequired(), "DISCONNECT asks the client to resync");
+        check(connection.resyncHint().resyncrequired(), "the last message tells the client to resync");
+        check(dropped(connection) == 3, "DISCONNECT counts everything the client missed");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2022, Sascha Huck <sascha@wirrewelt.de>
+ *
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Burst, refill and refunds of the token bucket behind the client quotas and the per-light write rate
+
+#include "../TokenBucket.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string& what) {
+    std::cout << (condition ? "ok   " : "FAIL ") << what << std::endl;
+    if (!condition) failures++;
+}
+
+}
+
+int main() {
+    using namespace std::chrono_literals;
+
+    {
+        TokenBucket bucket(10, 3);
+        std::chrono::microseconds wait(-1);
+
+        check(bucket.isFull(), "a new bucket starts full");
+        check(bucket.tryTake(wait) && wait == 0us, "a token is taken without waiting");
+        check(!bucket.isFull(), "a used bucket is no longer full");
+        check(bucket.tryTake(wait) && bucket.tryTake(wait), "a burst takes up to burst tokens");
+        check(!bucket.tryTake(wait), "an empty bucket refuses");
+        check(wait > 0us && wait <= 100001us, "the wait is at most the time one token takes to refill (got "
+                + std::to_string(wait.count()) + "us)");
+
+        std::this_thread::sleep_for(wait);
+        check(bucket.tryTake(wait), "a token is there after the wait");
+    }
+
+    {
+        TokenBucket bucket(1, 2);
+        std::chrono::microseconds wait;
+
+        bucket.tryTake(wait);
+        bucket.tryTake(wait);
+        bucket.refund();
+        check(bucket.tryTake(wait), "a refunded token can be taken again");
+
+        bucket.refund();
+        bucket.refund();
+        bucket.refund();
+        check(bucket.isFull(), "refunds fill the bucket");
+        check(bucket.tryTake(wait) && bucket.tryTake(wait) && !bucket.tryTake(wait), "refunds never go above burst");
+    }
+
+    {
+        TokenBucket bucket(100, 0);
+        std::chrono::microseconds wait;
+
+        check(bucket.tryTake(wait) && !bucket.tryTake(wait), "a burst below one still lets one request through");
+
+        std::this_thread::sleep_for(50ms);
+        check(bucket.isFull() && bucket.tryTake(wait) && !bucket.tryTake(wait), "refill stops at burst");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
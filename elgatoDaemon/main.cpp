@@ -4,13 +4,18 @@
 #include "../Config.h"
 #include "Log.h"
 #include "AvahiBrowser.h"
+#include "DaemonConfig.h"
+#include "SubnetScanner.h"
 #include "ElgatoServerImpl.h"
 
 int main([[maybe_unused]]int argc, [[maybe_unused]]char*argv[]) {
     std::clog.rdbuf(new Log("elgatoDaemon", LOG_LOCAL0));
     std::clog << kLogNotice << "Elgato daemon starting." << std::endl;
 
+    DaemonConfig::getInstance().load(std::string(CONFIG_PATH) + "/elgatoDaemon.json");
+
     AvahiBrowser::getInstance().start();
+    SubnetScanner::getInstance().start();
 
     ElgatoServerImpl elgatoServer;
     elgatoServer.RunServer(SOCKET_FILE);